@@ -0,0 +1,67 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "run_codec.h"
+#include <cstddef>
+#include <vector>
+
+/*
+ * Sort-scoped memory. A sort opens one arena, sized for its largest phase,
+ * and takes every buffer it needs from it: the memory load and the merge
+ * sort's scratch space, the block buffers, the merge heap and the gather
+ * frames. Allocation just bumps a pointer (every buffer is aligned to
+ * ARENA_ALIGNMENT bytes), and a phase gives its buffers back at once by
+ * releasing the arena to a mark taken at its start, so the next merge or
+ * pass reuses the same memory.
+ * If a request doesn't fit, another slab is added; slabs are only freed
+ * when the arena is closed, so after the first pass nothing is allocated.
+ *
+ * The arena also pools the run readers and writer of the sort, whose
+ * dictionaries keep their memory from one run to the next.
+ */
+#define ARENA_ALIGNMENT 64
+#define ARENA_MIN_SLAB (1L << 20)
+
+struct ArenaSlab {
+  char *base;
+  size_t size;
+};
+
+struct ArenaMark {
+  size_t slab;
+  size_t used;
+};
+
+struct SortArena {
+  std::vector<ArenaSlab> slabs;
+  // The slab being carved, and how much of it is taken
+  size_t slab;
+  size_t used;
+  std::vector<RunReader> readers;
+  RunWriter writer;
+};
+
+void arena_open(SortArena *arena, size_t size);
+
+void arena_close(SortArena *arena);
+
+void *arena_alloc(SortArena *arena, size_t bytes);
+
+/*
+ * Bytes taken by a buffer of <bytes> bytes (to size an arena)
+ */
+inline size_t arena_bytes(size_t bytes) {
+  return (bytes + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+template <typename T> T *arena_array(SortArena *arena, long count) {
+  return (T *)arena_alloc(arena, (size_t)count * sizeof(T));
+}
+
+ArenaMark arena_mark(const SortArena *arena);
+
+void arena_release(SortArena *arena, ArenaMark mark);
+
+RunReader *arena_readers(SortArena *arena, int count);
+
+#endif // ARENA_H
@@ -0,0 +1,34 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include "record.h"
+
+extern "C" {
+#include "BF.h"
+};
+
+/*
+ * Blocked Bloom filter over the sort key of a sorted file.
+ * Every key is mapped to exactly one filter block and all of its bits
+ * are set inside that block, so a probe never costs more than one block read.
+ */
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_NUM_HASHES 7
+#define BLOOM_BLOCK_BITS (BLOCK_SIZE * 8)
+
+int bloom_block_count(long num_keys);
+
+unsigned long bloom_hash(Record rec, int fieldNo);
+
+unsigned long bloom_hash(void *value, int fieldNo);
+
+int bloom_block_index(int num_blocks, unsigned long hash);
+
+void bloom_add(unsigned char *filter, int num_blocks, unsigned long hash);
+
+bool bloom_block_may_contain(const unsigned char *block, unsigned long hash);
+
+void write_bloom_filter(int file_desc, int first_block, unsigned char *filter,
+                        int num_blocks);
+
+#endif // BLOOM_H
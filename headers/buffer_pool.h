@@ -0,0 +1,44 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+/*
+ * Application level block cache that sits between the query code and the
+ * BF layer. Blocks are copied into frames that stay there until the clock
+ * hand evicts them, so repeated lookups on hot sorted files don't go back
+ * to the BF layer (which only keeps a handful of blocks of its own).
+ *
+ * The pool is split into shards (picked by hashing the file descriptor and
+ * block number), each with its own lock, frames and clock hand.
+ * A pinned frame is never evicted; every pin must be matched by an unpin.
+ * Invalidating a pinned block only marks its frame stale: lookups skip it,
+ * and it is dropped by its last unpin.
+ *
+ * Sequential passes (sorting, merging, full scans) deliberately read
+ * through read_block() instead, so they can't flush the pool.
+ */
+#define POOL_DEFAULT_CAPACITY 1024
+#define POOL_DEFAULT_SHARDS 8
+
+struct PoolStats {
+  long hits;
+  long misses;
+  long evictions;
+};
+
+void Pool_Init(int capacity, int num_shards);
+
+void *Pool_PinBlock(int file_desc, int block_num);
+
+void Pool_UnpinBlock(int file_desc, int block_num);
+
+void Pool_InvalidateBlock(int file_desc, int block_num);
+
+void Pool_InvalidateFile(int file_desc);
+
+PoolStats Pool_GetStats();
+
+void Pool_ResetStats();
+
+void Pool_PrintStats();
+
+#endif // BUFFER_POOL_H
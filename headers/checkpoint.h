@@ -0,0 +1,63 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "sorted.h"
+#include "spill.h"
+#include <string>
+#include <vector>
+
+/*
+ * Checkpointed sorts (see SortOptions.checkpoint_dir).
+ * The spill file of such a sort is a named file in the checkpoint
+ * directory, next to its manifest:
+ *   <dir>/<file>_Sorted_<fieldNo>.spill
+ *   <dir>/<file>_Sorted_<fieldNo>.checkpoint
+ * The manifest is rewritten (to a temporary file, which is then renamed
+ * over it) once the initial runs have been generated and after every merge
+ * step, and only after the spill file has been synced. It holds:
+ *  - the identity of the sort: the heap file (with its size and
+ *    modification time) and every option that shapes the runs
+ *  - the initial runs and the outputs of the finished merge steps, which
+ *    are enough to plan the same merges again
+ *  - the run directory of the spill file: the extents, blocks, chain
+ *    link and CRC-32 of every live run
+ *  - a CRC-32 of the manifest itself
+ *
+ * A sort that finds a manifest of the same sort reads every live run back
+ * and checks its CRC, and if they all match it picks up after the last
+ * finished merge. Otherwise it starts over. The files are removed once
+ * the sort succeeds.
+ */
+#define CHECKPOINT_VERSION 1
+
+struct SortJournal {
+  std::string spill_path;
+  std::string manifest_path;
+  // The identity lines of the manifest
+  std::string identity;
+};
+
+// The state of a sort that a checkpoint restores
+struct SortCheckpoint {
+  // The runs numbered by the merge plan (the initial runs, followed by
+  // the output of every merge step), as spill runs
+  std::vector<int> runs;
+  std::vector<long> run_blocks;
+  // -1: the initial runs have not been generated yet
+  int merges_done;
+  long total_records;
+  long input_records;
+};
+
+int journal_open(SortJournal *journal, const char *filename, int fieldNo,
+                 const SortOptions *options, int fan_in);
+
+int journal_resume(SortJournal *journal, SpillFile *spill, bool direct,
+                   SortCheckpoint *checkpoint);
+
+int journal_write(SortJournal *journal, SpillFile *spill,
+                   const SortCheckpoint *checkpoint);
+
+void journal_remove(SortJournal *journal);
+
+#endif // CHECKPOINT_H
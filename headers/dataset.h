@@ -0,0 +1,55 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include "record.h"
+#include <cstdio>
+
+/*
+ * Synthetic datasets in the CSV format of the datasets folder:
+ *   <id>,"<name>","<surname>","<city>"
+ *
+ * Every distribution is produced one record at a time, so a dataset is
+ * written without holding it in memory:
+ *
+ *  - DATASET_UNIFORM    random ids and random strings
+ *  - DATASET_SORTED     every field in ascending order
+ *  - DATASET_REVERSE    every field in descending order
+ *  - DATASET_ZIPF       keys drawn from ZIPF_KEYS ranks with a Zipf(1)
+ *                       distribution, so a few keys are very common
+ *  - DATASET_DUPLICATE  every record has the same fields
+ *  - DATASET_LONG       strings of the maximum length, with a long common
+ *                       prefix, which makes comparisons as slow as possible
+ */
+#define DATASET_UNIFORM 0
+#define DATASET_SORTED 1
+#define DATASET_REVERSE 2
+#define DATASET_ZIPF 3
+#define DATASET_DUPLICATE 4
+#define DATASET_LONG 5
+#define DATASET_COUNT 6
+
+#define ZIPF_KEYS 100000
+
+/*
+ * The name of a distribution, and its number (-1 if it is unknown)
+ */
+const char *dataset_name(int distribution);
+
+int dataset_distribution(const char *name);
+
+/*
+ * Writes <records> records of the given distribution to <stream>.
+ * The same seed always produces the same dataset.
+ * Returns 0 on success, -1 otherwise
+ */
+int write_dataset(FILE *stream, int distribution, long records,
+                  unsigned long seed);
+
+/*
+ * Parses a CSV line of a dataset (which is modified) into <record>.
+ * Returns false if the line is malformed, or if a field is too long
+ * for the record (see struct Record)
+ */
+bool parse_dataset_line(char *line, Record *record);
+
+#endif // DATASET_H
@@ -0,0 +1,93 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "sorted.h"
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "BF.h"
+};
+
+/*
+ * Incremental maintenance of sorted files (LSM style).
+ * Records inserted into a sorted file are kept in an in-memory memtable
+ * of the open file. A full memtable is sorted and flushed as a small
+ * sorted file of its own, a delta: <file>_Delta_<i>. The base file's header
+ * keeps the number of deltas and the records they hold.
+ * Only Sorted_CloseFile() makes the inserts durable: it flushes the
+ * memtable, and the base file's header reaches the disk once it is closed.
+ *
+ *  - Once a file has MAX_DELTA_FILES deltas, they are merged into one,
+ *    so the cost of an insert depends on the deltas only
+ *  - When the file is closed, the deltas are merged into the base file
+ *    if they hold at least 1 / DELTA_COMPACTION_RATIO of its records
+ *    (or whenever Sorted_CompactFile() is called)
+ *  - A sort of the file (by any field) compacts it first, since sorts
+ *    only read the file's own blocks
+ *
+ * Lookups and scans merge the base file, the deltas and the memtable
+ * on the fly. On equal keys the base file comes first, then the deltas
+ * (oldest first) and then the memtable, i.e. insertion order.
+ */
+#define MEMTABLE_RECORDS (16 * PAGE_MAX_RECORDS)
+#define MAX_DELTA_FILES 4
+#define DELTA_COMPACTION_RATIO 10
+
+/*
+ * One of the inputs of a merged scan: either a sorted file (read a block
+ * at a time) or a sorted array of records
+ */
+struct SortedSource {
+  int file_desc;
+  const std::vector<Record> *records;
+  int block_num;
+  int max_blocks;
+  int rec_num;
+  int count;
+  char block[BLOCK_SIZE];
+};
+
+/*
+ * A merge of sorted sources that is read one record at a time (see
+ * merged_next()). It can be copied, to save a position and read again
+ * from it later on
+ */
+struct MergedSource {
+  std::vector<SortedSource> sources;
+  std::vector<Record> current;
+  std::vector<int> heap;
+  int fieldNo;
+};
+
+std::string delta_file_name(const char *filename, int delta);
+
+void delta_register(int file_desc, const char *filename);
+
+bool delta_close(int file_desc, std::string *filename);
+
+int delta_insert(int file_desc, const Record &record);
+
+void delta_flush(int file_desc);
+
+const char *delta_base_name(int file_desc);
+
+std::vector<Record> delta_memtable(int file_desc, int fieldNo);
+
+int delta_compact(const char *filename);
+
+void source_open_file(SortedSource *source, int file_desc);
+
+void source_open_records(SortedSource *source,
+                         const std::vector<Record> *records);
+
+bool source_next(SortedSource *source, Record *record);
+
+void merged_open(MergedSource *merged, int fieldNo);
+
+bool merged_next(MergedSource *merged, Record *record);
+
+void merge_sources(std::vector<SortedSource> &sources, int fieldNo,
+                   void (*emit)(const Record &, void *), void *arg);
+
+#endif // DELTA_H
@@ -0,0 +1,62 @@
+#ifndef EXPLAIN_H
+#define EXPLAIN_H
+
+#include "sorted.h"
+
+/*
+ * I/O cost model of the external sort (see Sorted_ExplainSort()).
+ * Nothing is sorted: the heap file's block count comes from its header,
+ * and a sample of its first EXPLAIN_SAMPLE_BLOCKS blocks is encoded into
+ * run blocks, to find how many run blocks every heap file block needs
+ * (whole records, or key entries only).
+ *
+ * A records sort of a heap file that fits in memory reads it once and
+ * writes the sorted file, with no runs. Otherwise the model assumes
+ * unordered input, so every memory load becomes an initial run, and then
+ * follows the same merge plan as the sort itself:
+ *  - run generation reads the heap file and writes the initial runs
+ *  - every merge step reads and writes the blocks of its inputs
+ *  - the output reads the final run and writes the sorted file (and its
+ *    Bloom filter), whose new blocks are also read first. In
+ *    SORT_MODE_KEYS it also gathers the records from the heap file, in
+ *    windows of gather_blocks distinct blocks. With keys in random order,
+ *    a window of G blocks out of D holds about -D ln(1 - G / D) records,
+ *    and its blocks are read out of order
+ *  - the spill file's peak is the initial runs plus the output of the
+ *    largest merge step, in whole extents
+ *
+ * The cost of a configuration is its block reads and writes, with every
+ * out of order read counting EXPLAIN_RANDOM_COST times.
+ */
+#define EXPLAIN_SAMPLE_BLOCKS 16
+#define EXPLAIN_RANDOM_COST 4
+
+struct SortPrediction {
+  int mode;
+  int fan_in;
+  long data_blocks;
+  long records;
+  long runs;
+  long run_blocks;
+  int merge_steps;
+  double merge_passes;
+  long blocks_read;
+  long blocks_written;
+  long random_reads;
+  long temp_peak_blocks;
+  double cost;
+};
+
+struct SortPlan {
+  // The options of the cheapest configuration
+  SortOptions options;
+  SortPrediction prediction;
+  // Run blocks needed for every heap file block
+  double record_ratio;
+  double key_ratio;
+};
+
+SortPrediction predict_sort(long data_blocks, long records, double run_ratio,
+                            int mode, int fan_in, const SortOptions *options);
+
+#endif // EXPLAIN_H
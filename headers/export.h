@@ -0,0 +1,38 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "sorted.h"
+
+/*
+ * Bulk export of a file (see Sorted_ExportFile()).
+ * Records are formatted into large buffers and written with a few big
+ * write() calls, instead of a stream insertion per field:
+ *  - CSV:    the format of the datasets, id,"name","surname","city",
+ *            with every quote inside a string doubled
+ *  - NDJSON: one {"id":..,"name":..,"surname":..,"city":..} object per
+ *            line, with the strings escaped
+ *  - binary: the in-memory Records themselves, sizeof(Record) bytes each
+ *
+ * The blocks are read (the BF layer isn't thread safe) EXPORT_BATCH_BLOCKS
+ * at a time, and then every thread formats an equal share of the batch's
+ * records into a buffer of its own. The buffers are written in order, so
+ * the output follows the file's order.
+ * A sorted file with deltas (see delta.h) is exported merged with them,
+ * which is done by a single thread. The file must not be open, or the
+ * records of its memtable would be missed.
+ */
+#define EXPORT_FORMAT_CSV 0
+#define EXPORT_FORMAT_NDJSON 1
+#define EXPORT_FORMAT_BINARY 2
+
+#define EXPORT_BATCH_BLOCKS 256
+// The merged export writes its buffer once it holds this many bytes
+#define EXPORT_BUFFER_BYTES (1 << 20)
+
+struct ExportOptions {
+  int format = EXPORT_FORMAT_CSV;
+  // Threads that format the records (0: one per core)
+  int threads = 0;
+};
+
+#endif // EXPORT_H
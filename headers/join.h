@@ -0,0 +1,24 @@
+#ifndef JOIN_H
+#define JOIN_H
+
+#include "delta.h"
+
+/*
+ * Sort-merge join of two sorted files (see Sorted_MergeJoin()).
+ * Both files are read once, sequentially, side by side. For every key
+ * found on both sides, the right side's records with that key are
+ * buffered (up to JOIN_GROUP_BLOCKS blocks worth of records) and joined
+ * with every left record of the key. A group that does not fit is
+ * read again from the file for every left record, starting from where
+ * the buffered part ends.
+ * A file that is already sorted by the join field is read merged with its
+ * deltas (see delta.h), and is left as it is. It must not be open, or the
+ * records of its memtable would be missed.
+ * The joined records are buffered, JOIN_OUTPUT_RECORDS at a time, and
+ * written into the output as whole blocks.
+ */
+#define JOIN_GROUP_BLOCKS 64
+#define JOIN_GROUP_RECORDS (JOIN_GROUP_BLOCKS * PAGE_MAX_RECORDS)
+#define JOIN_OUTPUT_RECORDS (16 * PAGE_MAX_RECORDS)
+
+#endif // JOIN_H
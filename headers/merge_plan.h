@@ -0,0 +1,36 @@
+#ifndef MERGE_PLAN_H
+#define MERGE_PLAN_H
+
+#include <vector>
+
+/*
+ * Merge planning for the external sort.
+ * A k-way merge keeps one block per input run in memory (plus the output
+ * block), so the fan-in is bounded both by the memory budget and by the
+ * maximum number of runs we are allowed to have open at once.
+ * With direct I/O every open run holds a whole extent buffer instead
+ * (see spill.h), so the memory budget allows SPILL_EXTENT_BLOCKS times
+ * fewer of them.
+ *
+ * The plan is a Huffman-style merge tree: the smallest runs are merged
+ * first, and the very first merge takes just enough runs for every later
+ * merge to be a full k-way one (the same as padding with empty "dummy"
+ * runs). Only adjacent runs are merged together, so that the output of the
+ * merge stays stable.
+ */
+#define MERGE_MIN_FAN_IN 2
+
+struct MergeStep {
+  // Runs merged by the step, in input order
+  std::vector<int> inputs;
+  // The output run. Initial runs are numbered 0..n-1 and
+  // the output of step i is run n + i
+  int output;
+};
+
+int merge_fan_in(long memory_blocks, int max_open_runs, bool direct);
+
+std::vector<MergeStep> plan_merges(const std::vector<long> &run_blocks,
+                                   int fan_in, long *blocks_read);
+
+#endif // MERGE_PLAN_H
@@ -0,0 +1,26 @@
+#ifndef MULTI_SORT_H
+#define MULTI_SORT_H
+
+#include "sorted.h"
+
+/*
+ * Multi-field sort (see Sorted_SortFileByFields()): one scan of the heap
+ * file produces the sorted file of every requested field.
+ *
+ * The heap file is read memory_blocks at a time into a load of records,
+ * which is never moved. For every field, the load's references (see
+ * RecordRef) are sorted by that field, and the records are written in
+ * their order into a run of the field. The runs of all the fields share
+ * one spill file. Once the file has been read, the runs of every field are
+ * merged down with the field's own merge plan (see merge_plan.h) and
+ * decoded into <file>_Sorted_<field>, one field after the other.
+ * A heap file that fits in one load is not spilled at all: every sorted
+ * file is written straight from the load, in the order of its references.
+ *
+ * The sort is stable, so every sorted file is the same as the one that
+ * Sorted_SortFileWithOptions() writes, but the heap file is read once
+ * instead of once per field
+ */
+#define MAX_SORT_FIELDS 4
+
+#endif // MULTI_SORT_H
@@ -0,0 +1,36 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "sorted.h"
+#include <vector>
+
+/*
+ * Range-partitioned sort (see Sorted_ParallelSortFile()).
+ * A sample of the heap file (PARTITION_SAMPLE_BLOCKS evenly spaced blocks)
+ * is sorted to pick P - 1 splitters. Partition p then holds the records
+ * whose key is at least splitter p - 1 and less than splitter p, so equal
+ * keys always end up in the same partition.
+ *
+ * The heap file is read once, and every record is scattered into the heap
+ * file of its partition, <file>_Part_<p>, through a buffer of
+ * PARTITION_BUFFER_RECORDS records that is written as whole blocks.
+ * Every partition is then sorted by a worker process of its own, which
+ * shares nothing with the others, with the regular sort into
+ * <file>_Part_<p>_Sorted_<field>. The workers split the sort's threads
+ * between them. Since records are kept in file order, the concatenation
+ * of the partitions is the same as a (stable) sort of the whole file.
+ *
+ * The manifest <file>_Sorted_<field>_Manifest lists the partitions in
+ * order, one per line: <partition file> <records>
+ */
+#define PARTITION_SAMPLE_BLOCKS 32
+#define MAX_PARTITIONS 16
+#define PARTITION_BUFFER_RECORDS (16 * PAGE_MAX_RECORDS)
+
+std::vector<Record> pick_splitters(int file_desc, int fieldNo,
+                                   int partitions);
+
+int partition_of(const Record &rec, const std::vector<Record> &splitters,
+                 int fieldNo);
+
+#endif // PARTITION_H
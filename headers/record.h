@@ -1,22 +1,94 @@
 #ifndef RECORD
 #define RECORD
 
+/*
+ * The in-memory form of a record. On disk, records are stored with
+ * variable length (see add_record()), so these sizes only bound
+ * the longest value that can be kept: 23, 31 and 39 characters.
+ * The loaders reject longer values instead of cutting them short
+ */
 struct Record {
+  int id;
+  char name[24];
+  char surname[32];
+  char city[40];
+};
+
+/*
+ * The fixed size on-disk record of the previous block format,
+ * kept so that older files can still be read
+ */
+struct LegacyRecord {
   int id;
   char name[15];
   char surname[20];
   char city[25];
 };
 
-bool checkLessThan(Record rec, Record other, int fieldNo);
+/*
+ * Compact entry used by the key/record id sort mode: the sort key of a
+ * record in a normalized form (so that any two keys compare with memcmp)
+ * and the location of the record in the heap file
+ */
+#define KEY_SIZE sizeof(Record::city) // the largest field
+
+struct KeyEntry {
+  unsigned char key[KEY_SIZE];
+  unsigned char key_len;
+  short slot;
+  int block;
+};
+
+KeyEntry make_key_entry(Record rec, int fieldNo, int block, int slot);
+
+/*
+ * Entry of the group by aggregation: a normalized key (as above)
+ * along with the aggregates of the records that have it
+ */
+struct GroupEntry {
+  unsigned char key[KEY_SIZE];
+  unsigned char key_len;
+  int count;
+  int min_id;
+  int max_id;
+};
+
+GroupEntry make_group_entry(Record rec, int fieldNo);
+
+void combine_groups(GroupEntry *group, const GroupEntry &other);
+
+/*
+ * Entry of a multi-field sort: a pointer to a record of the load, so that
+ * the load is sorted by every field without moving the records themselves
+ */
+struct RecordRef {
+  const Record *record;
+};
+
+bool checkLessThan(const Record &rec, const Record &other, int fieldNo);
+
+bool checkLessThan(const Record &rec, void *value, int fieldNo);
+
+bool checkEqual(const Record &rec, const Record &other, int fieldNo);
+
+bool checkEqual(const Record &rec, void *value, int fieldNo);
+
+bool checkLessThan(const KeyEntry &entry, const KeyEntry &other, int fieldNo);
+
+bool checkEqual(const KeyEntry &entry, const KeyEntry &other, int fieldNo);
+
+bool checkLessThan(const GroupEntry &group, const GroupEntry &other,
+                   int fieldNo);
+
+bool checkEqual(const GroupEntry &group, const GroupEntry &other, int fieldNo);
 
-bool checkLessThan(Record rec, void *value, int fieldNo);
+bool checkLessThan(const RecordRef &ref, const RecordRef &other, int fieldNo);
 
-bool checkEqual(Record rec, Record other, int fieldNo);
+void init_page(void *beg);
 
-bool checkEqual(Record rec, void *value, int fieldNo);
+int get_record_count(void *beg);
 
-void save_record(Record record, int offset, void *beg);
+bool add_record(Record record, void *beg);
 
 Record get_record(int offset, void *beg);
 
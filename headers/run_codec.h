@@ -0,0 +1,97 @@
+#ifndef RUN_CODEC_H
+#define RUN_CODEC_H
+
+#include "record.h"
+#include "spill.h"
+#include <vector>
+
+extern "C" {
+#include "BF.h"
+};
+
+/*
+ * Temporary runs are written in a compact encoding instead of raw Records.
+ * Every run block starts with a small header (record count and flags),
+ * followed by the encoded records:
+ *  - the sort key is front coded against the previous record of the block
+ *    (string keys store the shared prefix length and the new suffix,
+ *     id keys store the difference from the previous id)
+ *  - the rest of the strings are stored without their padding
+ *  - the city (unless it is the sort key) is dictionary encoded, using a
+ *    dictionary that is built on the fly by both the writer and the reader
+ *
+ * Runs of key entries (key/record id sort mode) store the front coded key
+ * followed by the entry's block and slot, and runs of groups (group by)
+ * store the front coded key followed by the group's aggregates.
+ *
+ * Runs are always read from their first block to their last one, which is
+ * what allows the dictionary to span blocks. The first block of every run
+ * starts a new dictionary, so chains of runs can be read as one run.
+ * The dictionary's cities are kept in a flat array (the writer finds them
+ * through an open addressing table), which is allocated the first time a
+ * reader/writer is opened and then reused by every run it handles.
+ * The blocks themselves are stored in the sort's spill file (see spill.h).
+ */
+#define RUN_BLOCK_HEADER 3
+#define RUN_MAX_RECORDS 256
+#define RUN_DICT_SIZE 4096
+#define RUN_DICT_SLOTS (2 * RUN_DICT_SIZE)
+#define RUN_DICT_CITY ((int)sizeof(Record::city))
+
+// The block starts a new dictionary
+#define RUN_BLOCK_DICT_RESET 1
+
+struct RunWriter {
+  SpillFile *spill;
+  int run;
+  int fieldNo;
+  unsigned char block[BLOCK_SIZE];
+  int used;
+  int count;
+  bool dict_reset;
+  Record prev;
+  KeyEntry prev_key;
+  // The city of every code, its length, and the code of every table slot
+  std::vector<char> dict_cities;
+  std::vector<unsigned char> dict_lengths;
+  std::vector<short> dict_slots;
+  int dict_size;
+  long records;
+  long blocks;
+};
+
+struct RunReader {
+  SpillFile *spill;
+  int run;
+  int fieldNo;
+  long num_blocks;
+  long next_block;
+  unsigned char block[BLOCK_SIZE];
+  int pos;
+  int remaining;
+  Record prev;
+  KeyEntry prev_key;
+  std::vector<char> dict_cities;
+  std::vector<unsigned char> dict_lengths;
+  int dict_size;
+};
+
+void run_writer_open(RunWriter *writer, SpillFile *spill, int run, int fieldNo);
+
+void run_write(RunWriter *writer, const Record &record);
+
+void run_write(RunWriter *writer, const KeyEntry &entry);
+
+void run_write(RunWriter *writer, const GroupEntry &group);
+
+void run_writer_close(RunWriter *writer);
+
+void run_reader_open(RunReader *reader, SpillFile *spill, int run, int fieldNo);
+
+bool run_read(RunReader *reader, Record *record);
+
+bool run_read(RunReader *reader, KeyEntry *entry);
+
+bool run_read(RunReader *reader, GroupEntry *group);
+
+#endif // RUN_CODEC_H
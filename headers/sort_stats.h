@@ -0,0 +1,100 @@
+#ifndef SORT_STATS_H
+#define SORT_STATS_H
+
+#include <vector>
+
+/*
+ * Instrumentation of the sort.
+ * The counters below are kept for the whole process and are updated at
+ * the lowest level: read_block()/write_block() and the spill file's reads
+ * and writes count blocks (and the time spent waiting on them),
+ * checkLessThan() counts comparisons and every record written to a run or
+ * to a sorted file counts as moved.
+ *
+ * The counters are kept per thread: a parallel in-memory sort adds its
+ * threads' comparisons to the sorting thread's once they are done.
+ *
+ * A sort (one at a time per process) splits its work into phases:
+ * run generation, every merge step and the output. Each phase gets the
+ * difference of the counters between its start and end, along with its
+ * wall and CPU time. Progress callbacks are made from the block counting,
+ * at most once every interval.
+ */
+#define SORT_PHASE_NAME_SIZE 32
+
+struct SortCounters {
+  long blocks_read;
+  long blocks_written;
+  long comparisons;
+  long records_moved;
+  double io_wait_seconds;
+};
+
+extern thread_local SortCounters sort_counters;
+
+struct PhaseStats {
+  char name[SORT_PHASE_NAME_SIZE];
+  double wall_seconds;
+  double cpu_seconds;
+  SortCounters counters;
+};
+
+struct SortStats {
+  long input_records;
+  long output_records;
+  // The blocks of every initial run
+  std::vector<long> run_blocks;
+  int merge_steps;
+  // How many times every block of the initial runs was merged, on average
+  double merge_passes;
+  // The largest size of the spill file
+  long temp_peak_blocks;
+  std::vector<PhaseStats> phases;
+  double wall_seconds;
+  double cpu_seconds;
+  SortCounters totals;
+};
+
+struct SortProgress {
+  const char *phase;
+  long blocks_done;
+  // An estimate, refined once the merges have been planned
+  long blocks_total;
+  double elapsed_seconds;
+  double eta_seconds;
+};
+
+typedef void (*SortProgressCallback)(const SortProgress *progress, void *arg);
+
+double stats_clock();
+
+void stats_tick();
+
+/*
+ * Counts a block read or written, which took <seconds>
+ */
+inline void count_block_read(double seconds) {
+  sort_counters.blocks_read++;
+  sort_counters.io_wait_seconds += seconds;
+  stats_tick();
+}
+
+inline void count_block_written(double seconds) {
+  sort_counters.blocks_written++;
+  sort_counters.io_wait_seconds += seconds;
+}
+
+void stats_begin_sort(SortStats *stats, SortProgressCallback progress,
+                      void *progress_arg, double progress_interval);
+
+void stats_end_sort();
+
+void stats_begin_phase(const char *name);
+
+void stats_end_phase();
+
+void stats_expect_blocks(long blocks_total);
+
+int stats_write_json(const SortStats *stats, const char *filename);
+
+#endif // SORT_STATS_H
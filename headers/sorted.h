@@ -1,6 +1,8 @@
 #ifndef SORTED_H
 #define SORTED_H
 #include "record.h"
+#include "sort_stats.h"
+#include <cstddef>
 
 #define FILE_TYPE_OFFSET BLOCK_SIZE / sizeof(int) - 1
 #define HEAP_FILE 256
@@ -8,8 +10,104 @@
 #define FILE_SORTED 255
 #define FILE_NOT_SORTED 254
 #define SORTED_BY_OFFSET BLOCK_SIZE / sizeof(int) - 3
-#define MAX_RECORDS BLOCK_SIZE / sizeof(Record) - 1
+#define BLOOM_BLOCKS_OFFSET BLOCK_SIZE / sizeof(int) - 4
+#define RECORD_COUNT_OFFSET BLOCK_SIZE / sizeof(int) - 5
+#define DELTA_COUNT_OFFSET BLOCK_SIZE / sizeof(int) - 6
+#define DELTA_RECORDS_OFFSET BLOCK_SIZE / sizeof(int) - 7
 #define FILLED_OFFSET BLOCK_SIZE / sizeof(int) - 1
+// The BF layer allocates at most this many blocks per file
+#define BF_MAX_BLOCKS 8192
+
+/*
+ * Data blocks use a slotted page layout:
+ *
+ *  | rec 0 | rec 1 | ... free space ... | slot n-1 | ... | slot 0 | free | count |
+ *
+ * Records are stored with variable length (the id, then each string as a
+ * length byte followed by its characters) and the slot directory at the
+ * end of the block holds the offset of every record, so a record can
+ * still be found directly by its number.
+ * The last int of the block (FILLED_OFFSET) holds the record count in its
+ * lower half and SLOTTED_PAGE_MAGIC in its upper half, right before it
+ * is the offset of the free space.
+ *
+ * Blocks of the previous format (a plain count in the last int and
+ * MAX_RECORDS fixed size LegacyRecords) are still readable.
+ */
+#define SLOTTED_PAGE_MAGIC 0x5370
+#define PAGE_TRAILER_SIZE 6
+#define PAGE_SLOT_SIZE 2
+#define MIN_RECORD_SIZE (sizeof(int) + 3)
+#define PAGE_MAX_RECORDS                                                       \
+  ((BLOCK_SIZE - PAGE_TRAILER_SIZE) / (MIN_RECORD_SIZE + PAGE_SLOT_SIZE))
+#define MAX_RECORDS BLOCK_SIZE / sizeof(LegacyRecord) - 1
+
+// The runs hold whole records
+#define SORT_MODE_RECORDS 0
+// The runs hold (key, record id) entries and the records are gathered
+// from the heap file after the last merge
+#define SORT_MODE_KEYS 1
+
+// Every record is kept
+#define SORT_AGGREGATE_NONE 0
+// Only the first record of every key is kept
+#define SORT_AGGREGATE_DISTINCT 1
+// Every key is written (as CSV) along with the number of its records
+// and their smallest and largest id
+#define SORT_AGGREGATE_GROUP_BY 2
+
+struct SortPlan;
+struct ExportOptions;
+
+struct SortOptions {
+  int mode = SORT_MODE_RECORDS;
+  // Heap file blocks kept in memory by the gather pass (SORT_MODE_KEYS)
+  int gather_blocks = 256;
+  // Directory of the spill file (NULL: $TMPDIR, or /tmp)
+  const char *temp_dir = nullptr;
+  // Keep the sort out of the page cache: the spill file uses direct,
+  // extent sized I/O (see spill.h), and the heap file's pages are dropped
+  // once it has been sorted. The sorted file is still cached
+  bool direct_io = false;
+  // Journal the sort's runs and merges in this directory, so that a sort
+  // that was cut short picks up where it stopped (see checkpoint.h)
+  const char *checkpoint_dir = nullptr;
+  // Memory budget in blocks: the size of the initial runs, and
+  // (along with max_open_runs) the fan-in of the merges
+  long memory_blocks = 64;
+  int max_open_runs = 16;
+  // Threads that sort a heap file which fits in memory as a whole
+  // (0: one per core)
+  int threads = 0;
+  // Only the first <limit> records are kept (0: all of them)
+  long limit = 0;
+  // Equal keys are collapsed as early as possible (during run generation
+  // and every merge), see SORT_AGGREGATE_*
+  int aggregate = SORT_AGGREGATE_NONE;
+  // Filled in with the statistics of the sort (see sort_stats.h)
+  SortStats *stats = nullptr;
+  // The statistics are also written there as JSON
+  const char *stats_json = nullptr;
+  // Called with the progress of the sort (and an estimate of the time
+  // left) at most once every <progress_interval> seconds
+  SortProgressCallback progress = nullptr;
+  void *progress_arg = nullptr;
+  double progress_interval = 1.0;
+};
+
+/*
+ * The final output of a sort: records are buffered into full blocks of the
+ * sorted file, and every key is added to the file's Bloom filter
+ */
+struct SortedOutput {
+  int file_desc;
+  int fieldNo;
+  int bloom_blocks;
+  unsigned char *filter;
+  Record *buffer;
+  int buffer_size;
+  long num_records;
+};
 
 int get_new_block(int file_id);
 
@@ -17,6 +115,17 @@ void write_block(int file_id, int block_num);
 
 void *read_block(int file_id, int block_num);
 
+int first_data_block(void *header);
+
+int create_sorted_file(const char *filename, int fieldNo, int bloom_blocks);
+
+int sorted_output_open(SortedOutput *out, const char *filename, int fieldNo,
+                       long num_records);
+
+void sorted_output_add(SortedOutput *out, const Record &rec);
+
+void sorted_output_close(SortedOutput *out);
+
 int Sorted_CreateFile(const char *fileName);
 
 int Sorted_OpenFile(const char *fileName);
@@ -24,15 +133,90 @@ int Sorted_OpenFile(const char *fileName);
 int Sorted_CloseFile(const int file_desc);
 
 /**
- * Saves all of the records in a serial manner
+ * Saves all of the records in a serial manner.
+ * Records inserted into a sorted file go to its delta files (see delta.h).
+ * Inserts are not durable until Sorted_CloseFile() returns: records of a
+ * sorted file wait in the open file's in-memory memtable, and the BF layer
+ * keeps every written block in memory until the file is closed. A crash
+ * before the close loses them
  */
 int Sorted_InsertEntry(int fileDesc, Record record);
 
+/**
+ * Merges the delta files of a (closed) sorted file into the file itself
+ */
+int Sorted_CompactFile(const char *fileName);
+
 /**
  * Sorts the file
  */
 int Sorted_SortFile(const char *fileName, int fieldNo);
 
+/**
+ * Sorts the file, as described by <options>.
+ * With a limit, only the first <limit> records are written,
+ * into <fileName>_Top_<limit>_<fieldNo>.
+ * Aggregating sorts write <fileName>_Distinct_<fieldNo> or
+ * <fileName>_GroupBy_<fieldNo>.csv instead
+ */
+int Sorted_SortFileWithOptions(const char *fileName, int fieldNo,
+                               const SortOptions *options);
+
+/**
+ * The memory (in bytes) that a sort with <options> takes
+ * (along with the extent buffers of its merges, with direct I/O)
+ */
+size_t Sorted_SortMemory(const SortOptions *options);
+
+/**
+ * Sorts the file by each of its <numFields> <fields> into
+ * <fileName>_Sorted_<field>, reading it only once (see multi_sort.h).
+ * <options> must have neither a limit, an aggregate nor a checkpoint
+ * directory, and the runs always hold whole records
+ */
+int Sorted_SortFileByFields(const char *fileName, const int *fields,
+                            int numFields, const SortOptions *options);
+
+/**
+ * Sorts the file as <partitions> range partitions, each one sorted by a
+ * worker process of its own (as described by <options>, which must not
+ * have a limit or an aggregate). The partitions, in order, are listed by
+ * the manifest <fileName>_Sorted_<fieldNo>_Manifest (see partition.h)
+ */
+int Sorted_ParallelSortFile(const char *fileName, int fieldNo, int partitions,
+                            const SortOptions *options);
+
+/**
+ * Joins the two files on <fieldNo> with a sort-merge join. A file that is
+ * not already sorted by <fieldNo> is sorted first (into its _Sorted_ file).
+ * Every joined pair is written as two consecutive records (left, then
+ * right) of the heap file <fileA>_Join_<fileB>_<fieldNo>.
+ * Returns the number of pairs, or -1 on failure
+ */
+long Sorted_MergeJoin(const char *fileA, const char *fileB, int fieldNo);
+
+/**
+ * Predicts the I/O of sorting the file (without sorting it) for every
+ * configuration that <options> allows, prints the predictions and keeps
+ * the cheapest one, along with the options to run it, in <plan>
+ * (see explain.h)
+ */
+int Sorted_ExplainSort(const char *fileName, int fieldNo,
+                       const SortOptions *options, SortPlan *plan);
+
+/**
+ * Prints the predictions of <plan> next to the statistics of the sort
+ */
+void Sorted_ReportPlan(const SortPlan *plan, const SortStats *stats);
+
+/**
+ * Writes every record of the file into <outputName> ("-": the standard
+ * output) as CSV, NDJSON or binary records, as described by <options>
+ * (see export.h). Returns the number of records, or -1 on failure
+ */
+long Sorted_ExportFile(const char *fileName, const char *outputName,
+                       const ExportOptions *options);
+
 /**
  * Checks whether the given file is sorted
  */
@@ -46,4 +230,11 @@ int Sorted_CheckSortedFile(const char *fileName, int fieldNo);
  */
 void Sorted_GetAllEntries(int fileDesc, int *fieldNo, void *value);
 
+/**
+ * Returns the number of entries (of the file, its deltas and its memtable)
+ * whose fieldNo is equal to *value, without printing them,
+ * or -1 if the file is not sorted by fieldNo
+ */
+long Sorted_CountEntries(int fileDesc, int fieldNo, void *value);
+
 #endif // SORTED_H
@@ -0,0 +1,85 @@
+#ifndef SORTER_H
+#define SORTER_H
+
+#include "record.h"
+#include "run_codec.h"
+#include "spill.h"
+#include <cstddef>
+#include <vector>
+
+/*
+ * Embeddable sorter: records are pushed from memory and pulled back in
+ * order, without going through a heap file.
+ *
+ *   ExternalSorter sorter;
+ *   Sorter_Open(&sorter, &options);
+ *   Sorter_Push(&sorter, rec) / Sorter_PushBatch(&sorter, recs, count)
+ *   Sorter_Finish(&sorter);
+ *   while (Sorter_Next(&sorter, &rec)) ...
+ *   Sorter_Close(&sorter);
+ *
+ * The pushed records are buffered in memory. As long as they all fit in
+ * memory_bytes (half of it holds the records, the other half the merge
+ * sort's scratch space), nothing touches the disk: Sorter_Finish() sorts
+ * the buffer and Sorter_Next() walks it. Once the buffer is full, it is
+ * sorted and written to a spill file as a run (see spill.h and
+ * run_codec.h), and Sorter_Next() pulls from a merge of the runs. If there
+ * are more runs than the fan-in allows, Sorter_Finish() first merges them
+ * with the sort's own merge plan (see merge_plan.h) until one final merge
+ * is left.
+ *
+ * Records are ordered by <fieldNo>, or by <less> if it is given (the runs
+ * are still encoded by <fieldNo>). The sort is stable: records that
+ * compare equal come out in the order they were pushed.
+ */
+typedef bool (*SorterLess)(const Record &rec, const Record &other, void *arg);
+
+struct SorterOptions {
+  int fieldNo = 0;
+  // NULL: compare by fieldNo
+  SorterLess less = nullptr;
+  void *less_arg = nullptr;
+  // The memory of the record buffer and its scratch space
+  size_t memory_bytes = 8L << 20;
+  int max_open_runs = 16;
+  // Directory of the spill file (NULL: $TMPDIR, or /tmp)
+  const char *temp_dir = nullptr;
+  bool direct_io = false;
+};
+
+struct ExternalSorter {
+  SorterOptions options;
+  std::vector<Record> buffer;
+  std::vector<Record> scratch;
+  // Records that fit in the buffer
+  size_t capacity;
+  bool spilled;
+  SpillFile spill;
+  RunWriter writer;
+  // The runs, in push order, and their sizes
+  std::vector<int> runs;
+  std::vector<long> run_blocks;
+  bool finished;
+  // In memory: the next record of the buffer
+  size_t next;
+  // Spilled: the inputs of the final merge
+  std::vector<RunReader> readers;
+  std::vector<Record> current;
+  std::vector<int> heap;
+  long records;
+};
+
+int Sorter_Open(ExternalSorter *sorter, const SorterOptions *options);
+
+int Sorter_Push(ExternalSorter *sorter, const Record &record);
+
+int Sorter_PushBatch(ExternalSorter *sorter, const Record *records,
+                     long count);
+
+int Sorter_Finish(ExternalSorter *sorter);
+
+bool Sorter_Next(ExternalSorter *sorter, Record *record);
+
+void Sorter_Close(ExternalSorter *sorter);
+
+#endif // SORTER_H
@@ -0,0 +1,103 @@
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * The temporary runs of a sort live inside a single spill file (in the
+ * sort's temp directory) instead of one BF file per run.
+ * The file is preallocated in large steps and split into extents of
+ * SPILL_EXTENT_BLOCKS blocks. A run is a list of extents, kept in the
+ * in-memory run directory. Freeing a run returns its extents to the free
+ * list, so every pass reuses the space of the runs it has consumed.
+ *
+ * Runs can also be linked into chains (the reader goes on to the next run
+ * of the chain once a run is over), which lets the sort grow an initial run
+ * at either end without copying it.
+ *
+ * The spill file is unlinked as soon as it is created, so it goes away
+ * with the process no matter how the sort ends. A checkpointed sort
+ * (see checkpoint.h) opens a named spill file instead, which outlives
+ * the process, and only that one keeps a CRC-32 of every run, to
+ * validate it later.
+ *
+ * In direct mode the spill file stays out of the page cache. It is opened
+ * with O_DIRECT, and every run is written and read a whole extent at a
+ * time, through extent buffers aligned to SPILL_IO_ALIGNMENT (a run
+ * holds one buffer while it is being written, and one while it is being
+ * read; freed runs give them back for reuse). If the file system doesn't
+ * support O_DIRECT, the same extent I/O goes through the page cache and
+ * every extent is dropped from it once it has been written or read.
+ */
+#define SPILL_EXTENT_BLOCKS 64
+#define SPILL_GROW_EXTENTS 64
+#define SPILL_IO_ALIGNMENT 4096
+
+struct SpillRun {
+  std::vector<long> extents;
+  long num_blocks;
+  // The next run of the chain, or -1
+  int next;
+  bool live;
+  // CRC-32 of the run's blocks, in order (only of a checksummed spill file)
+  unsigned int checksum;
+  // Direct mode: the extent being written, and the last extent read
+  char *write_buffer;
+  char *read_buffer;
+  long read_extent;
+};
+
+struct SpillFile {
+  int fd;
+  std::string path;
+  long num_extents;
+  long allocated_extents;
+  std::vector<long> free_extents;
+  std::vector<SpillRun> runs;
+  bool direct;
+  // The file was opened with O_DIRECT
+  bool o_direct;
+  // The runs keep their CRC-32 (the named spill file of a checkpointed
+  // sort). No other spill file pays for it
+  bool checksummed;
+  // Every extent buffer, and the ones not held by a run
+  std::vector<char *> buffers;
+  std::vector<char *> free_buffers;
+};
+
+const char *default_temp_dir();
+
+int spill_open(SpillFile *spill, const char *temp_dir, bool direct);
+
+int spill_open_path(SpillFile *spill, const char *path, bool direct,
+                    bool truncate);
+
+void spill_sync(SpillFile *spill);
+
+void spill_close(SpillFile *spill);
+
+int spill_create_run(SpillFile *spill);
+
+void spill_append_block(SpillFile *spill, int run, const void *data);
+
+void spill_flush_run(SpillFile *spill, int run);
+
+void spill_read_block(SpillFile *spill, int run, long block_num, void *data);
+
+long spill_run_blocks(SpillFile *spill, int run);
+
+void spill_link_runs(SpillFile *spill, int run, int next);
+
+int spill_next_run(SpillFile *spill, int run);
+
+void spill_free_run(SpillFile *spill, int run);
+
+bool spill_verify_run(SpillFile *spill, int run);
+
+unsigned int spill_crc32(unsigned int crc, const void *data, size_t len);
+
+void drop_page_cache(const char *filename);
+
+#endif // SPILL_H
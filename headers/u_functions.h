@@ -2,34 +2,96 @@
 #define U_FUNCTIONS_H
 
 #include "record.h"
+#include "spill.h"
 #include <string>
 #include <vector>
 
 extern "C" {
 #include "BF.h"
 };
-#define BUFFER_SIZE MAX_RECORDS
+#define BUFFER_SIZE PAGE_MAX_RECORDS
+
+// Ranges of the in-memory merge sort that are insertion sorted
+#define MERGE_SORT_LEAF 16
+// The fewest entries worth a thread of their own in a parallel sort
+#define PARALLEL_SORT_MIN_ENTRIES 8192
+
+struct SortArena;
 
 void merge(Record *arr, int l, int m, int r, int fieldNo);
 
 void merge_sort(Record *arr, int l, int r, int fieldNo);
 
-void merge_into_block(int inp1_fd, int inp2_fd, int outp, int fieldNo);
+/*
+ * With a <scratch> buffer of at least r - l + 1 entries
+ */
+void merge_sort(Record *arr, int l, int r, int fieldNo, Record *scratch);
+
+/*
+ * Sorts <size> records with up to <threads> threads, using a <scratch>
+ * buffer of as many records
+ */
+void parallel_merge_sort(Record *arr, int size, int fieldNo, Record *scratch,
+                         int threads);
+
+void merge(KeyEntry *arr, int l, int m, int r, int fieldNo);
+
+void merge_sort(KeyEntry *arr, int l, int r, int fieldNo);
+
+void merge_sort(KeyEntry *arr, int l, int r, int fieldNo, KeyEntry *scratch);
+
+void merge(GroupEntry *arr, int l, int m, int r, int fieldNo);
+
+void merge_sort(GroupEntry *arr, int l, int r, int fieldNo);
+
+void merge_sort(GroupEntry *arr, int l, int r, int fieldNo,
+                GroupEntry *scratch);
+
+/*
+ * Sorts <size> references (see RecordRef) with up to <threads> threads,
+ * using a <scratch> buffer of as many references
+ */
+void parallel_merge_sort(RecordRef *arr, int size, int fieldNo,
+                         RecordRef *scratch, int threads);
+
+int collapse_entries(Record *arr, int size, int fieldNo);
+
+int collapse_entries(KeyEntry *arr, int size, int fieldNo);
+
+int collapse_entries(GroupEntry *arr, int size, int fieldNo);
+
+long merge_into_run(SpillFile *spill, const std::vector<int> &inputs,
+                    int outp_run, int fieldNo, long limit, bool distinct,
+                    SortArena *arena);
+
+long merge_keys_into_run(SpillFile *spill, const std::vector<int> &inputs,
+                         int outp_run, int fieldNo, long limit, bool distinct,
+                         SortArena *arena);
+
+long merge_groups_into_run(SpillFile *spill, const std::vector<int> &inputs,
+                           int outp_run, int fieldNo, long limit,
+                           SortArena *arena);
 
 void flush_buffer(Record *buf, int file_desc, int max);
 
 void fill_buffer(Record *buffer, void *beg, int *size);
 
-std::string get_tmp_file_name(int file_num, int curr_run);
+char *get_sorted_file_name(const char *file_name, int fieldNo);
 
-void remove_input_files(int n, int curr_run);
+char *get_top_file_name(const char *file_name, int fieldNo, long limit);
 
-std::vector<std::string> create_files(int num, int run);
+char *get_aggregate_file_name(const char *file_name, int fieldNo,
+                              int aggregate);
 
-char *get_sorted_file_name(const char *file_name, int fieldNo);
+char *get_join_file_name(const char *left, const char *right, int fieldNo);
+
+char *get_partition_file_name(const char *file_name, int partition);
+
+char *get_manifest_file_name(const char *file_name, int fieldNo);
 
 int print_surrounding_records(int curr_block, int file_desc, int curr_rec_index,
-                              void *value, int fieldNo, int *rec_read);
+                              void *value, int fieldNo, int *rec_read,
+                              bool print);
 
 std::string field_number_value(int fieldNo);
 #endif // U_FUNCTIONS_H
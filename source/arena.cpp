@@ -0,0 +1,74 @@
+#include "../headers/arena.h"
+#include <cstdlib>
+#include <iostream>
+
+static void add_slab(SortArena *arena, size_t size) {
+  size = arena_bytes(size < (size_t)ARENA_MIN_SLAB ? ARENA_MIN_SLAB : size);
+  char *base = (char *)aligned_alloc(ARENA_ALIGNMENT, size);
+  if (base == NULL) {
+    std::cerr << "Error allocating " << size << " bytes for the sort"
+              << std::endl;
+    exit(1);
+  }
+  arena->slabs.push_back({base, size});
+}
+
+/*
+ * Opens an arena whose first slab holds <size> bytes
+ */
+extern void arena_open(SortArena *arena, size_t size) {
+  arena->slabs.clear();
+  add_slab(arena, size);
+  arena->slab = 0;
+  arena->used = 0;
+}
+
+extern void arena_close(SortArena *arena) {
+  for (ArenaSlab &slab : arena->slabs) {
+    free(slab.base);
+  }
+  arena->slabs.clear();
+  arena->readers.clear();
+}
+
+/*
+ * Returns an aligned buffer of <bytes> bytes, which stays valid
+ * until the arena is released to a mark taken before it
+ */
+extern void *arena_alloc(SortArena *arena, size_t bytes) {
+  bytes = arena_bytes(bytes);
+  // Go on to the next slab that fits, or add one
+  while (arena->used + bytes > arena->slabs[arena->slab].size) {
+    if (arena->slab + 1 == arena->slabs.size()) {
+      add_slab(arena, bytes);
+    }
+    arena->slab++;
+    arena->used = 0;
+  }
+  void *buffer = arena->slabs[arena->slab].base + arena->used;
+  arena->used += bytes;
+  return buffer;
+}
+
+extern ArenaMark arena_mark(const SortArena *arena) {
+  return {arena->slab, arena->used};
+}
+
+/*
+ * Gives back every buffer taken after <mark>
+ */
+extern void arena_release(SortArena *arena, ArenaMark mark) {
+  arena->slab = mark.slab;
+  arena->used = mark.used;
+}
+
+/*
+ * Returns <count> pooled run readers. They must not be in use anymore
+ * when this is called again
+ */
+extern RunReader *arena_readers(SortArena *arena, int count) {
+  if ((int)arena->readers.size() < count) {
+    arena->readers.resize((size_t)count);
+  }
+  return arena->readers.data();
+}
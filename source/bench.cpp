@@ -0,0 +1,404 @@
+#include "../headers/bloom.h"
+#include "../headers/buffer_pool.h"
+#include "../headers/dataset.h"
+#include "../headers/export.h"
+#include "../headers/sorted.h"
+#include "../headers/u_functions.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Benchmark harness:
+ *   bench [-n records] [-f field] [-l lookups] [-m memory blocks] [-D]
+ *         [-d work dir] [-o output json] [distribution ...]
+ *
+ * For every distribution (all of them by default, see dataset.h) a dataset
+ * is generated in the work dir and then the phases below are measured
+ * separately (-D sorts with direct I/O, see SortOptions.direct_io):
+ *  - ingest:  Sorted_CreateFile() and Sorted_InsertEntry() of every record
+ *  - sort:    Sorted_SortFileWithOptions()
+ *  - check:   Sorted_CheckSortedFile() of the sorted file
+ *  - lookups: Sorted_CountEntries() of keys sampled from the dataset
+ *  - export:  Sorted_ExportFile() of the sorted file as CSV
+ *
+ * Every phase reports its time, its throughput, the bytes it read and
+ * wrote (both through syscalls and from/to the disk, as counted by
+ * /proc/self/io) and its buffer pool hits and misses. The results are
+ * written as JSON.
+ *
+ * Both the heap file and the sorted file must fit in the BF layer's
+ * BF_MAX_BLOCKS blocks, which bounds the size of a dataset (about 70000
+ * records of the long distribution), so every dataset is checked
+ * before its ingest.
+ */
+struct BenchConfig {
+  long records = 50000;
+  int fieldNo = 0;
+  long lookups = 1000;
+  long memory_blocks = 64;
+  bool direct_io = false;
+  std::string dir = "bench_files";
+  std::string output;
+  std::vector<int> distributions;
+};
+
+struct IoCounters {
+  long rchar = 0;
+  long wchar = 0;
+  long read_bytes = 0;
+  long write_bytes = 0;
+};
+
+struct PhaseResult {
+  double seconds;
+  long items;
+  IoCounters io;
+  PoolStats pool;
+};
+
+static IoCounters read_io_counters() {
+  IoCounters io;
+  std::ifstream proc("/proc/self/io");
+  std::string name;
+  long value;
+  while (proc >> name >> value) {
+    if (name == "rchar:") {
+      io.rchar = value;
+    } else if (name == "wchar:") {
+      io.wchar = value;
+    } else if (name == "read_bytes:") {
+      io.read_bytes = value;
+    } else if (name == "write_bytes:") {
+      io.write_bytes = value;
+    }
+  }
+  return io;
+}
+
+/*
+ * Measures a phase. The library's own output is dropped meanwhile
+ */
+template <typename Phase>
+static PhaseResult measure(long items, Phase phase) {
+  static std::ofstream null_stream("/dev/null");
+  std::streambuf *saved = std::cout.rdbuf(null_stream.rdbuf());
+  Pool_ResetStats();
+  IoCounters before = read_io_counters();
+  auto start = std::chrono::steady_clock::now();
+
+  phase();
+
+  auto end = std::chrono::steady_clock::now();
+  IoCounters after = read_io_counters();
+  std::cout.rdbuf(saved);
+
+  PhaseResult result;
+  result.seconds = std::chrono::duration<double>(end - start).count();
+  result.items = items;
+  result.io.rchar = after.rchar - before.rchar;
+  result.io.wchar = after.wchar - before.wchar;
+  result.io.read_bytes = after.read_bytes - before.read_bytes;
+  result.io.write_bytes = after.write_bytes - before.write_bytes;
+  result.pool = Pool_GetStats();
+  return result;
+}
+
+static void write_phase(FILE *json, const char *name,
+                        const PhaseResult &result, bool last) {
+  fprintf(json,
+          "        \"%s\": {\"seconds\": %.6f, \"items\": %ld, "
+          "\"items_per_sec\": %.1f, \"bytes_read\": %ld, "
+          "\"bytes_written\": %ld, \"disk_bytes_read\": %ld, "
+          "\"disk_bytes_written\": %ld, \"pool_hits\": %ld, "
+          "\"pool_misses\": %ld}%s\n",
+          name, result.seconds, result.items,
+          result.seconds > 0 ? result.items / result.seconds : 0.0,
+          result.io.rchar, result.io.wchar, result.io.read_bytes,
+          result.io.write_bytes, result.pool.hits, result.pool.misses,
+          last ? "" : ",");
+}
+
+static long file_size(const std::string &filename) {
+  struct stat st;
+  return stat(filename.c_str(), &st) == 0 ? (long)st.st_size : -1;
+}
+
+/*
+ * The blocks that <size> records take when they are added to the pages
+ * in order, starting a new page every <chunk> records (as flush_buffer()
+ * does with every buffer it is given)
+ */
+static long packed_blocks(const Record *records, long size, long chunk) {
+  char page[BLOCK_SIZE];
+  long blocks = 0;
+  for (long i = 0; i < size; i++) {
+    if (i % chunk == 0 || !add_record(records[i], page)) {
+      memset(page, 0, BLOCK_SIZE);
+      init_page(page);
+      add_record(records[i], page);
+      blocks++;
+    }
+  }
+  return blocks;
+}
+
+/*
+ * Checks that the heap file of the dataset <csv> and its sorted file
+ * by <fieldNo> both fit in BF_MAX_BLOCKS blocks.
+ * Prints why not and returns false otherwise
+ */
+static bool dataset_fits(const std::string &csv, int fieldNo) {
+  FILE *input = fopen(csv.c_str(), "r");
+  if (input == NULL) {
+    perror("Error opening the dataset");
+    return false;
+  }
+  // No block holds more than PAGE_MAX_RECORDS records
+  long max_records = (long)BF_MAX_BLOCKS * PAGE_MAX_RECORDS;
+  std::vector<Record> records;
+  char *line = NULL;
+  size_t len = 0;
+  Record record;
+  while (getline(&line, &len, input) != -1 &&
+         (long)records.size() <= max_records) {
+    if (parse_dataset_line(line, &record)) {
+      records.push_back(record);
+    }
+  }
+  free(line);
+  fclose(input);
+
+  long size = (long)records.size();
+  long heap_blocks = 1 + packed_blocks(records.data(), size, size + 1);
+  long sorted_blocks = BF_MAX_BLOCKS + 1;
+  if (size <= max_records) {
+    merge_sort(records.data(), 0, (int)size - 1, fieldNo);
+    sorted_blocks = 1 + bloom_block_count(size) +
+                    packed_blocks(records.data(), size, BUFFER_SIZE);
+  }
+  long blocks = heap_blocks > sorted_blocks ? heap_blocks : sorted_blocks;
+  if (blocks > BF_MAX_BLOCKS) {
+    std::cerr << "The dataset " << csv << " needs more than "
+              << BF_MAX_BLOCKS << " blocks, the most that a BF file holds."
+              << " Use fewer records (-n)" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * The entry of a distribution that could not be measured at all
+ */
+static void write_error(FILE *json, int distribution, const char *error,
+                        bool last) {
+  fprintf(json, "    {\"distribution\": \"%s\", \"error\": \"%s\"}%s\n",
+          dataset_name(distribution), error, last ? "" : ",");
+}
+
+/*
+ * Generates the dataset of a distribution and measures its phases.
+ * Returns false if a phase failed (a distribution that can't be measured
+ * at all still gets an entry, with its error)
+ */
+static bool bench_distribution(const BenchConfig &config, int distribution,
+                               FILE *json, bool last) {
+  std::string base = config.dir + "/" + dataset_name(distribution);
+  std::string csv = base + ".csv";
+  std::string sorted = base + "_Sorted_" + std::to_string(config.fieldNo);
+  remove(base.c_str());
+  remove(sorted.c_str());
+
+  std::cerr << "Generating " << config.records << " "
+            << dataset_name(distribution) << " records" << std::endl;
+  FILE *stream = fopen(csv.c_str(), "w");
+  if (stream == NULL ||
+      write_dataset(stream, distribution, config.records, distribution) < 0 ||
+      fclose(stream) != 0) {
+    std::cerr << "Error writing " << csv << std::endl;
+    write_error(json, distribution, "the dataset could not be written", last);
+    return false;
+  }
+  if (!dataset_fits(csv, config.fieldNo)) {
+    remove(csv.c_str());
+    write_error(json, distribution, "the dataset needs too many blocks",
+                last);
+    return false;
+  }
+
+  // Every <step>-th record's key is looked up later
+  std::vector<Record> keys;
+  long step = config.lookups > 0 ? config.records / config.lookups : 0;
+  bool ok = true;
+
+  PhaseResult ingest = measure(config.records, [&]() {
+    if (Sorted_CreateFile(base.c_str()) < 0) {
+      ok = false;
+      return;
+    }
+    int file_desc = Sorted_OpenFile(base.c_str());
+    FILE *input = fopen(csv.c_str(), "r");
+    char *line = NULL;
+    size_t len = 0;
+    Record record;
+    for (long i = 0; getline(&line, &len, input) != -1; i++) {
+      if (!parse_dataset_line(line, &record)) {
+        continue;
+      }
+      Sorted_InsertEntry(file_desc, record);
+      if (step > 0 && i % step == 0 && (long)keys.size() < config.lookups) {
+        keys.push_back(record);
+      }
+    }
+    free(line);
+    fclose(input);
+    Sorted_CloseFile(file_desc);
+  });
+
+  SortOptions options;
+  options.memory_blocks = config.memory_blocks;
+  options.direct_io = config.direct_io;
+  PhaseResult sort = measure(config.records, [&]() {
+    ok = ok && Sorted_SortFileWithOptions(base.c_str(), config.fieldNo,
+                                          &options) == 0;
+  });
+
+  bool is_sorted = false;
+  PhaseResult check = measure(config.records, [&]() {
+    is_sorted = Sorted_CheckSortedFile(sorted.c_str(), config.fieldNo) == 0;
+  });
+
+  PhaseResult lookups = measure((long)keys.size(), [&]() {
+    int fieldNo = config.fieldNo;
+    int file_desc = Sorted_OpenFile(sorted.c_str());
+    if (file_desc < 0) {
+      ok = false;
+      return;
+    }
+    for (Record &key : keys) {
+      void *value = fieldNo == 0   ? (void *)&key.id
+                    : fieldNo == 1 ? (void *)key.name
+                    : fieldNo == 2 ? (void *)key.surname
+                                   : (void *)key.city;
+      ok = ok && Sorted_CountEntries(file_desc, fieldNo, value) > 0;
+    }
+    Sorted_CloseFile(file_desc);
+  });
+
+  std::string exported = sorted + ".csv";
+  ExportOptions export_options;
+  PhaseResult exports = measure(config.records, [&]() {
+    ok = ok && Sorted_ExportFile(sorted.c_str(), exported.c_str(),
+                                 &export_options) == config.records;
+  });
+  remove(exported.c_str());
+
+  fprintf(json,
+          "    {\"distribution\": \"%s\", \"sorted\": %s, "
+          "\"csv_bytes\": %ld, \"heap_file_bytes\": %ld, "
+          "\"sorted_file_bytes\": %ld,\n      \"phases\": {\n",
+          dataset_name(distribution), is_sorted ? "true" : "false",
+          file_size(csv), file_size(base), file_size(sorted));
+  write_phase(json, "ingest", ingest, false);
+  write_phase(json, "sort", sort, false);
+  write_phase(json, "check", check, false);
+  write_phase(json, "lookups", lookups, false);
+  write_phase(json, "export", exports, true);
+  fprintf(json, "      }}%s\n", last ? "" : ",");
+
+  remove(csv.c_str());
+  remove(base.c_str());
+  remove(sorted.c_str());
+  return ok && is_sorted;
+}
+
+static bool parse_args(int argc, char **argv, BenchConfig *config) {
+  int opt;
+  while ((opt = getopt(argc, argv, "n:f:l:m:Dd:o:")) != -1) {
+    switch (opt) {
+    case 'n':
+      config->records = atol(optarg);
+      break;
+    case 'f':
+      config->fieldNo = atoi(optarg);
+      break;
+    case 'l':
+      config->lookups = atol(optarg);
+      break;
+    case 'm':
+      config->memory_blocks = atol(optarg);
+      break;
+    case 'D':
+      config->direct_io = true;
+      break;
+    case 'd':
+      config->dir = optarg;
+      break;
+    case 'o':
+      config->output = optarg;
+      break;
+    default:
+      return false;
+    }
+  }
+  for (int i = optind; i < argc; i++) {
+    int distribution = dataset_distribution(argv[i]);
+    if (distribution < 0) {
+      std::cerr << "Unknown distribution: " << argv[i] << std::endl;
+      return false;
+    }
+    config->distributions.push_back(distribution);
+  }
+  if (config->distributions.empty()) {
+    for (int distribution = 0; distribution < DATASET_COUNT; distribution++) {
+      config->distributions.push_back(distribution);
+    }
+  }
+  if (config->output.empty()) {
+    config->output = config->dir + "/bench.json";
+  }
+  return config->records > 0 && config->fieldNo >= 0 && config->fieldNo <= 3;
+}
+
+int main(int argc, char **argv) {
+  BenchConfig config;
+  if (!parse_args(argc, argv, &config)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [-n records] [-f field] [-l lookups] [-m memory blocks]"
+                 " [-D] [-d work dir] [-o output json] [distribution ...]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  mkdir(config.dir.c_str(), 0755);
+
+  BF_Init();
+  Pool_Init(POOL_DEFAULT_CAPACITY, POOL_DEFAULT_SHARDS);
+
+  FILE *json = fopen(config.output.c_str(), "w");
+  if (json == NULL) {
+    perror("Error creating the output");
+    return EXIT_FAILURE;
+  }
+  fprintf(json,
+          "{\n  \"records\": %ld, \"field\": %d, \"memory_blocks\": %ld, "
+          "\"direct_io\": %s, \"lookups\": %ld,\n  \"runs\": [\n",
+          config.records, config.fieldNo, config.memory_blocks,
+          config.direct_io ? "true" : "false", config.lookups);
+  bool ok = true;
+  for (size_t i = 0; i < config.distributions.size(); i++) {
+    ok = bench_distribution(config, config.distributions[i], json,
+                            i + 1 == config.distributions.size()) &&
+         ok;
+  }
+  fprintf(json, "  ]\n}\n");
+  fclose(json);
+
+  std::cerr << "Results written to " << config.output << std::endl;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,115 @@
+#include "../headers/bloom.h"
+#include "../headers/sorted.h"
+#include <cstring>
+
+/*
+ * Returns the number of filter blocks needed for <num_keys> keys
+ * (at least one, so that every sorted file has a usable filter)
+ */
+extern int bloom_block_count(long num_keys) {
+  long bits = num_keys * BLOOM_BITS_PER_KEY;
+  long blocks = (bits + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+  return blocks > 0 ? (int)blocks : 1;
+}
+
+/*
+ * FNV-1a over the key bytes, followed by a final avalanche step so that
+ * both halves of the result can be used as independent hashes
+ */
+static unsigned long hash_bytes(const void *data, size_t len) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  unsigned long hash = 14695981039346656037UL;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211UL;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdUL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53UL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/*
+ * Hashes the record's <fieldNo>. Equal keys (as defined by checkEqual)
+ * always produce the same hash
+ */
+extern unsigned long bloom_hash(Record rec, int fieldNo) {
+  switch (fieldNo) {
+  case 0:
+    return hash_bytes(&rec.id, sizeof(rec.id));
+  case 1:
+    return hash_bytes(rec.name, strlen(rec.name));
+  case 2:
+    return hash_bytes(rec.surname, strlen(rec.surname));
+  case 3:
+    return hash_bytes(rec.city, strlen(rec.city));
+  default:
+    return 0;
+  }
+}
+
+/*
+ * Same as above, but for a given value instead of a record
+ */
+extern unsigned long bloom_hash(void *value, int fieldNo) {
+  if (fieldNo == 0) {
+    return hash_bytes(value, sizeof(int));
+  }
+  return hash_bytes(value, strlen((char *)value));
+}
+
+/*
+ * The filter block that holds all of the bits of a key
+ */
+extern int bloom_block_index(int num_blocks, unsigned long hash) {
+  return (int)(hash % (unsigned long)num_blocks);
+}
+
+/*
+ * The bit positions inside the block are derived with double hashing
+ * from the upper half of the hash (the lower half picks the block)
+ */
+static unsigned int bloom_bit(unsigned long hash, int i) {
+  unsigned int h1 = (unsigned int)(hash >> 32);
+  unsigned int h2 = (unsigned int)(hash >> 17) | 1;
+  return (h1 + i * h2) % BLOOM_BLOCK_BITS;
+}
+
+extern void bloom_add(unsigned char *filter, int num_blocks,
+                      unsigned long hash) {
+  unsigned char *block =
+      filter + (long)bloom_block_index(num_blocks, hash) * BLOCK_SIZE;
+  for (int i = 0; i < BLOOM_NUM_HASHES; i++) {
+    unsigned int bit = bloom_bit(hash, i);
+    block[bit / 8] |= (unsigned char)(1 << (bit % 8));
+  }
+}
+
+/*
+ * Returns false only if the key is definitely not in the file
+ */
+extern bool bloom_block_may_contain(const unsigned char *block,
+                                    unsigned long hash) {
+  for (int i = 0; i < BLOOM_NUM_HASHES; i++) {
+    unsigned int bit = bloom_bit(hash, i);
+    if (!(block[bit / 8] & (1 << (bit % 8)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Copies the in-memory filter into the (already allocated) blocks
+ * [first_block, first_block + num_blocks) of the given file
+ */
+extern void write_bloom_filter(int file_desc, int first_block,
+                               unsigned char *filter, int num_blocks) {
+  for (int i = 0; i < num_blocks; i++) {
+    void *beg = read_block(file_desc, first_block + i);
+    memcpy(beg, filter + (long)i * BLOCK_SIZE, BLOCK_SIZE);
+    write_block(file_desc, first_block + i);
+  }
+}
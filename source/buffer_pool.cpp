@@ -0,0 +1,258 @@
+#include "../headers/buffer_pool.h"
+#include "../headers/sorted.h"
+#include "../headers/u_functions.h"
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct Frame {
+  int file_desc;
+  int block_num;
+  int pin_count;
+  bool referenced;
+  bool valid;
+  // Invalidated while pinned: no longer found by lookups, and dropped
+  // by its last unpin
+  bool stale;
+  char data[BLOCK_SIZE];
+};
+
+struct PoolShard {
+  std::mutex lock;
+  std::vector<Frame> frames;
+  std::unordered_map<long, int> frame_of;
+  int hand;
+  // The number of stale frames
+  int stale_frames;
+  PoolStats stats;
+};
+
+static std::vector<PoolShard *> shards;
+
+// The BF layer itself is not thread safe, so misses are serialized
+static std::mutex bf_lock;
+
+static long frame_key(int file_desc, int block_num) {
+  return ((long)file_desc << 32) | (unsigned int)block_num;
+}
+
+static PoolShard *shard_of(int file_desc, int block_num) {
+  unsigned long hash = (unsigned long)frame_key(file_desc, block_num);
+  hash *= 0x9e3779b97f4a7c15UL;
+  return shards[(hash >> 32) % shards.size()];
+}
+
+/*
+ * (Re)creates the pool with <capacity> frames split over <num_shards> shards.
+ * Any cached block is dropped
+ */
+extern void Pool_Init(int capacity, int num_shards) {
+  for (PoolShard *shard : shards) {
+    delete shard;
+  }
+  shards.clear();
+
+  if (num_shards < 1) {
+    num_shards = 1;
+  }
+  if (capacity < num_shards) {
+    capacity = num_shards;
+  }
+
+  for (int i = 0; i < num_shards; i++) {
+    PoolShard *shard = new PoolShard();
+    // Spread the remainder over the first shards
+    int frames = capacity / num_shards + (i < capacity % num_shards ? 1 : 0);
+    shard->frames = std::vector<Frame>((size_t)frames);
+    for (Frame &frame : shard->frames) {
+      frame.pin_count = 0;
+      frame.referenced = false;
+      frame.valid = false;
+      frame.stale = false;
+    }
+    shard->hand = 0;
+    shard->stale_frames = 0;
+    shard->stats = PoolStats{0, 0, 0};
+    shards.push_back(shard);
+  }
+}
+
+/*
+ * Clock eviction: sweep the frames, giving every referenced frame
+ * a second chance. Pinned frames are skipped.
+ * Returns -1 if every frame of the shard is pinned
+ */
+static int find_victim(PoolShard *shard) {
+  int num_frames = (int)shard->frames.size();
+  for (int step = 0; step < 2 * num_frames; step++) {
+    int index = shard->hand;
+    shard->hand = (shard->hand + 1) % num_frames;
+    Frame &frame = shard->frames[index];
+    if (!frame.valid) {
+      return index;
+    }
+    if (frame.pin_count > 0) {
+      continue;
+    }
+    if (frame.referenced) {
+      frame.referenced = false;
+      continue;
+    }
+    shard->frame_of.erase(frame_key(frame.file_desc, frame.block_num));
+    shard->stats.evictions++;
+    frame.valid = false;
+    return index;
+  }
+  return -1;
+}
+
+/*
+ * Returns a pointer to a cached copy of the requested block and pins it.
+ * The copy must not be modified (writes go through write_block())
+ */
+extern void *Pool_PinBlock(int file_desc, int block_num) {
+  if (shards.empty()) {
+    Pool_Init(POOL_DEFAULT_CAPACITY, POOL_DEFAULT_SHARDS);
+  }
+
+  PoolShard *shard = shard_of(file_desc, block_num);
+  std::lock_guard<std::mutex> guard(shard->lock);
+
+  auto found = shard->frame_of.find(frame_key(file_desc, block_num));
+  if (found != shard->frame_of.end()) {
+    Frame &frame = shard->frames[found->second];
+    frame.pin_count++;
+    frame.referenced = true;
+    shard->stats.hits++;
+    return frame.data;
+  }
+
+  shard->stats.misses++;
+  int index = find_victim(shard);
+  if (index < 0) {
+    std::cerr << "Every buffer pool frame is pinned" << std::endl;
+    exit(1);
+  }
+
+  Frame &frame = shard->frames[index];
+  {
+    std::lock_guard<std::mutex> bf_guard(bf_lock);
+    memcpy(frame.data, read_block(file_desc, block_num), BLOCK_SIZE);
+  }
+  frame.file_desc = file_desc;
+  frame.block_num = block_num;
+  frame.pin_count = 1;
+  frame.referenced = true;
+  frame.valid = true;
+  frame.stale = false;
+  shard->frame_of[frame_key(file_desc, block_num)] = index;
+  return frame.data;
+}
+
+/*
+ * Drops a frame, unless it is still pinned, in which case it is only
+ * marked stale
+ */
+static void drop_frame(PoolShard *shard, Frame *frame) {
+  if (frame->pin_count > 0) {
+    frame->stale = true;
+    shard->stale_frames++;
+  } else {
+    frame->valid = false;
+  }
+}
+
+/*
+ * Pins taken before a block was invalidated are released first,
+ * so a stale copy of the block goes before the cached one
+ */
+extern void Pool_UnpinBlock(int file_desc, int block_num) {
+  if (shards.empty()) {
+    return;
+  }
+  PoolShard *shard = shard_of(file_desc, block_num);
+  std::lock_guard<std::mutex> guard(shard->lock);
+  for (int i = 0; shard->stale_frames > 0 && i < (int)shard->frames.size();
+       i++) {
+    Frame &frame = shard->frames[i];
+    if (frame.valid && frame.stale && frame.file_desc == file_desc &&
+        frame.block_num == block_num) {
+      if (--frame.pin_count == 0) {
+        frame.valid = false;
+        frame.stale = false;
+        shard->stale_frames--;
+      }
+      return;
+    }
+  }
+  auto found = shard->frame_of.find(frame_key(file_desc, block_num));
+  if (found != shard->frame_of.end() &&
+      shard->frames[found->second].pin_count > 0) {
+    shard->frames[found->second].pin_count--;
+  }
+}
+
+/*
+ * Drops the cached copy of a block (called whenever the block is written).
+ * A pinned copy stays readable until its last unpin, but is not found
+ * by any later pin
+ */
+extern void Pool_InvalidateBlock(int file_desc, int block_num) {
+  if (shards.empty()) {
+    return;
+  }
+  PoolShard *shard = shard_of(file_desc, block_num);
+  std::lock_guard<std::mutex> guard(shard->lock);
+  auto found = shard->frame_of.find(frame_key(file_desc, block_num));
+  if (found != shard->frame_of.end()) {
+    drop_frame(shard, &shard->frames[found->second]);
+    shard->frame_of.erase(found);
+  }
+}
+
+/*
+ * Drops every cached block of a file. File descriptors are reused by the
+ * BF layer, so this is done both when a file is opened and when it is closed
+ */
+extern void Pool_InvalidateFile(int file_desc) {
+  for (PoolShard *shard : shards) {
+    std::lock_guard<std::mutex> guard(shard->lock);
+    for (Frame &frame : shard->frames) {
+      if (frame.valid && !frame.stale && frame.file_desc == file_desc) {
+        shard->frame_of.erase(frame_key(frame.file_desc, frame.block_num));
+        drop_frame(shard, &frame);
+      }
+    }
+  }
+}
+
+extern PoolStats Pool_GetStats() {
+  PoolStats total = {0, 0, 0};
+  for (PoolShard *shard : shards) {
+    std::lock_guard<std::mutex> guard(shard->lock);
+    total.hits += shard->stats.hits;
+    total.misses += shard->stats.misses;
+    total.evictions += shard->stats.evictions;
+  }
+  return total;
+}
+
+extern void Pool_ResetStats() {
+  for (PoolShard *shard : shards) {
+    std::lock_guard<std::mutex> guard(shard->lock);
+    shard->stats = PoolStats{0, 0, 0};
+  }
+}
+
+extern void Pool_PrintStats() {
+  PoolStats stats = Pool_GetStats();
+  long accesses = stats.hits + stats.misses;
+  std::cout << "Buffer pool: " << stats.hits << " hits, " << stats.misses
+            << " misses, " << stats.evictions << " evictions";
+  if (accesses > 0) {
+    std::cout << " (hit rate " << (100.0 * stats.hits / accesses) << "%)";
+  }
+  std::cout << std::endl;
+}
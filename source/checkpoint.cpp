@@ -0,0 +1,233 @@
+#include "../headers/checkpoint.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Sets up the journal of a checkpointed sort of <filename>
+ * (see checkpoint.h). Returns 0 on success, -1 otherwise
+ */
+extern int journal_open(SortJournal *journal, const char *filename,
+                        int fieldNo, const SortOptions *options, int fan_in) {
+  struct stat st;
+  if (stat(filename, &st) != 0) {
+    perror("Error reading the heap file");
+    return -1;
+  }
+  mkdir(options->checkpoint_dir, 0755);
+
+  const char *name = strrchr(filename, '/');
+  name = name != NULL ? name + 1 : filename;
+  std::stringstream base;
+  base << options->checkpoint_dir << "/" << name << "_Sorted_" << fieldNo;
+  journal->spill_path = base.str() + ".spill";
+  journal->manifest_path = base.str() + ".checkpoint";
+
+  std::stringstream identity;
+  identity << "external_sort checkpoint " << CHECKPOINT_VERSION << "\n"
+           << "input " << (long)st.st_size << " " << (long)st.st_mtim.tv_sec
+           << " " << st.st_mtim.tv_nsec << " " << filename << "\n"
+           << "sort " << fieldNo << " " << options->mode << " "
+           << options->aggregate << " " << options->limit << " "
+           << options->memory_blocks << " " << fan_in << "\n";
+  journal->identity = identity.str();
+  return 0;
+}
+
+/*
+ * Parses the state and run directory of a manifest (whatever follows
+ * its identity). Returns false if it is malformed
+ */
+static bool parse_state(std::istream &in, SpillFile *spill,
+                        SortCheckpoint *checkpoint) {
+  std::string tag;
+  size_t count;
+  if (!(in >> tag >> checkpoint->merges_done >> checkpoint->total_records >>
+        checkpoint->input_records >> spill->num_extents >>
+        spill->allocated_extents) ||
+      tag != "state") {
+    return false;
+  }
+  if (!(in >> tag >> count) || tag != "runs") {
+    return false;
+  }
+  checkpoint->runs.resize(count);
+  for (int &run : checkpoint->runs) {
+    in >> run;
+  }
+  if (!(in >> tag >> count) || tag != "run_blocks") {
+    return false;
+  }
+  checkpoint->run_blocks.resize(count);
+  for (long &blocks : checkpoint->run_blocks) {
+    in >> blocks;
+  }
+
+  // The run directory: every run is there, but only live ones are listed
+  if (!(in >> tag >> count) || tag != "spill") {
+    return false;
+  }
+  spill->runs.assign(count, SpillRun());
+  for (SpillRun &run : spill->runs) {
+    run.num_blocks = 0;
+    run.next = -1;
+    run.live = false;
+    run.checksum = 0;
+    run.write_buffer = NULL;
+    run.read_buffer = NULL;
+    run.read_extent = -1;
+  }
+  std::vector<bool> used((size_t)spill->num_extents, false);
+  size_t id;
+  while (in >> tag && tag == "live") {
+    size_t num_extents;
+    if (!(in >> id) || id >= spill->runs.size()) {
+      return false;
+    }
+    SpillRun &run = spill->runs[id];
+    in >> run.num_blocks >> run.next >> run.checksum >> num_extents;
+    run.live = true;
+    run.extents.resize(num_extents);
+    for (long &extent : run.extents) {
+      if (!(in >> extent) || extent < 0 || extent >= spill->num_extents) {
+        return false;
+      }
+      used[extent] = true;
+    }
+  }
+  if (!in || tag != "end") {
+    return false;
+  }
+  for (long extent = 0; extent < spill->num_extents; extent++) {
+    if (!used[extent]) {
+      spill->free_extents.push_back(extent);
+    }
+  }
+  return true;
+}
+
+/*
+ * Opens the spill file of a checkpointed sort. If the last checkpoint
+ * belongs to the same sort and all of its runs are intact, <spill> and
+ * <checkpoint> are restored from it and 1 is returned. Otherwise the sort
+ * starts over with an empty spill file, and 0 is returned.
+ * Returns -1 on failure
+ */
+extern int journal_resume(SortJournal *journal, SpillFile *spill, bool direct,
+                          SortCheckpoint *checkpoint) {
+  std::ifstream manifest(journal->manifest_path);
+  std::stringstream contents;
+  contents << manifest.rdbuf();
+  std::string text = contents.str();
+
+  // The manifest ends with the CRC-32 of everything before it
+  size_t crc_line = text.rfind("crc ");
+  bool valid = manifest.is_open() && crc_line != std::string::npos &&
+               text.compare(0, journal->identity.size(), journal->identity) ==
+                   0 &&
+               strtoul(text.c_str() + crc_line + 4, NULL, 10) ==
+                   spill_crc32(0, text.data(), crc_line);
+
+  if (valid && spill_open_path(spill, journal->spill_path.c_str(), direct,
+                               false) == 0) {
+    std::istringstream in(text.substr(journal->identity.size(),
+                                      crc_line - journal->identity.size()));
+    valid = parse_state(in, spill, checkpoint);
+    for (size_t run = 0; valid && run < spill->runs.size(); run++) {
+      if (spill->runs[run].live && !spill_verify_run(spill, (int)run)) {
+        std::cerr << "Checkpointed run " << run << " is damaged" << std::endl;
+        valid = false;
+      }
+    }
+    if (valid) {
+      std::cout << "Resuming the sort after " << checkpoint->merges_done
+                << " merge steps" << std::endl;
+      return 1;
+    }
+    spill_close(spill);
+  }
+
+  if (spill_open_path(spill, journal->spill_path.c_str(), direct, true) < 0) {
+    return -1;
+  }
+  checkpoint->runs.clear();
+  checkpoint->run_blocks.clear();
+  checkpoint->merges_done = -1;
+  checkpoint->total_records = 0;
+  checkpoint->input_records = 0;
+  return 0;
+}
+
+/*
+ * Records <checkpoint> (along with the spill file's run directory),
+ * once the spill file is durable.
+ * Returns 0, or -1 if the manifest could not be written (the previous
+ * one is then left in place)
+ */
+extern int journal_write(SortJournal *journal, SpillFile *spill,
+                          const SortCheckpoint *checkpoint) {
+  spill_sync(spill);
+
+  std::stringstream out;
+  out << journal->identity;
+  out << "state " << checkpoint->merges_done << " "
+      << checkpoint->total_records << " " << checkpoint->input_records << " "
+      << spill->num_extents << " " << spill->allocated_extents << "\n";
+  out << "runs " << checkpoint->runs.size();
+  for (int run : checkpoint->runs) {
+    out << " " << run;
+  }
+  out << "\nrun_blocks " << checkpoint->run_blocks.size();
+  for (long blocks : checkpoint->run_blocks) {
+    out << " " << blocks;
+  }
+  out << "\nspill " << spill->runs.size() << "\n";
+  for (size_t id = 0; id < spill->runs.size(); id++) {
+    const SpillRun &run = spill->runs[id];
+    if (!run.live) {
+      continue;
+    }
+    out << "live " << id << " " << run.num_blocks << " " << run.next << " "
+        << run.checksum << " " << run.extents.size();
+    for (long extent : run.extents) {
+      out << " " << extent;
+    }
+    out << "\n";
+  }
+  out << "end\n";
+  std::string text = out.str();
+  text += "crc " + std::to_string(spill_crc32(0, text.data(), text.size())) +
+          "\n";
+
+  // Written next to the manifest, and then renamed over it
+  std::string temp_path = journal->manifest_path + ".tmp";
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror("Error writing the checkpoint");
+    return -1;
+  }
+  bool written =
+      write(fd, text.data(), text.size()) == (ssize_t)text.size() &&
+      fsync(fd) == 0;
+  if (close(fd) != 0 || !written ||
+      rename(temp_path.c_str(), journal->manifest_path.c_str()) != 0) {
+    perror("Error writing the checkpoint");
+    unlink(temp_path.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Removes the spill file and the manifest of a finished sort
+ */
+extern void journal_remove(SortJournal *journal) {
+  unlink(journal->manifest_path.c_str());
+  unlink(journal->spill_path.c_str());
+}
@@ -0,0 +1,187 @@
+#include "../headers/dataset.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static const char *dataset_names[DATASET_COUNT] = {
+    "uniform", "sorted", "reverse", "zipf", "duplicate", "long"};
+
+extern const char *dataset_name(int distribution) {
+  if (distribution < 0 || distribution >= DATASET_COUNT) {
+    return NULL;
+  }
+  return dataset_names[distribution];
+}
+
+extern int dataset_distribution(const char *name) {
+  for (int distribution = 0; distribution < DATASET_COUNT; distribution++) {
+    if (strcmp(name, dataset_names[distribution]) == 0) {
+      return distribution;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Fills <str> with <len> random letters (the first one capitalized)
+ */
+static void random_string(std::mt19937_64 &rng, char *str, int len) {
+  for (int i = 0; i < len; i++) {
+    str[i] = (char)((i == 0 ? 'A' : 'a') + rng() % 26);
+  }
+  str[len] = 0;
+}
+
+/*
+ * Same as above, with a random length between 3 and 12
+ * (that still fits in <size> bytes)
+ */
+static void random_word(std::mt19937_64 &rng, char *str, int size) {
+  int len = 3 + (int)(rng() % 10);
+  random_string(rng, str, std::min(len, size - 1));
+}
+
+/*
+ * Same as above, with the maximum length and a common prefix
+ */
+static void long_string(std::mt19937_64 &rng, char *str, int size) {
+  static const char prefix[] = "Longcommonprefix";
+  int prefix_len = std::min((int)sizeof(prefix) - 1, size - 2);
+  memcpy(str, prefix, prefix_len);
+  random_string(rng, str + prefix_len, size - 1 - prefix_len);
+  str[prefix_len] = (char)(str[prefix_len] - 'A' + 'a');
+}
+
+/*
+ * Zipf(1) ranks: a uniform draw is looked up in the cumulative distribution
+ */
+struct ZipfSampler {
+  std::vector<double> cdf;
+
+  ZipfSampler() : cdf(ZIPF_KEYS) {
+    double sum = 0;
+    for (int rank = 0; rank < ZIPF_KEYS; rank++) {
+      sum += 1.0 / (rank + 1);
+      cdf[rank] = sum;
+    }
+    for (double &p : cdf) {
+      p /= sum;
+    }
+  }
+
+  int next(std::mt19937_64 &rng) {
+    double u = std::uniform_real_distribution<double>(0, 1)(rng);
+    int rank = (int)(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+    return std::min(rank, ZIPF_KEYS - 1);
+  }
+};
+
+/*
+ * Scatters ranks over the positive ints (multiplying by an odd number
+ * is a bijection modulo 2^31), so that rank order is not id order
+ */
+static int scatter(long rank) {
+  return (int)(((unsigned long)rank * 2654435761UL) & 0x7fffffffUL);
+}
+
+static void make_record(int distribution, long i, long records,
+                        std::mt19937_64 &rng, ZipfSampler *zipf,
+                        Record *record) {
+  memset(record, 0, sizeof(*record));
+  switch (distribution) {
+  case DATASET_UNIFORM:
+    record->id = (int)(rng() & 0x7fffffff);
+    random_word(rng, record->name, sizeof(record->name));
+    random_word(rng, record->surname, sizeof(record->surname));
+    random_word(rng, record->city, sizeof(record->city));
+    break;
+  case DATASET_SORTED:
+  case DATASET_REVERSE: {
+    long key = distribution == DATASET_SORTED ? i : records - 1 - i;
+    record->id = (int)key;
+    snprintf(record->name, sizeof(record->name), "Name%010ld", key);
+    snprintf(record->surname, sizeof(record->surname), "Surname%010ld", key);
+    snprintf(record->city, sizeof(record->city), "City%010ld", key);
+    break;
+  }
+  case DATASET_ZIPF:
+    record->id = scatter(zipf->next(rng));
+    snprintf(record->name, sizeof(record->name), "Name%d", zipf->next(rng));
+    snprintf(record->surname, sizeof(record->surname), "Surname%d",
+             zipf->next(rng));
+    snprintf(record->city, sizeof(record->city), "City%d", zipf->next(rng));
+    break;
+  case DATASET_DUPLICATE:
+    record->id = 42;
+    strcpy(record->name, "Same");
+    strcpy(record->surname, "Duplicate");
+    strcpy(record->city, "Everywhere");
+    break;
+  case DATASET_LONG:
+    record->id = (int)(rng() & 0x7fffffff);
+    long_string(rng, record->name, sizeof(record->name));
+    long_string(rng, record->surname, sizeof(record->surname));
+    long_string(rng, record->city, sizeof(record->city));
+    break;
+  }
+}
+
+extern int write_dataset(FILE *stream, int distribution, long records,
+                         unsigned long seed) {
+  if (dataset_name(distribution) == NULL || records < 0) {
+    return -1;
+  }
+  std::mt19937_64 rng(seed);
+  ZipfSampler *zipf = distribution == DATASET_ZIPF ? new ZipfSampler() : NULL;
+  Record record;
+  for (long i = 0; i < records; i++) {
+    make_record(distribution, i, records, rng, zipf, &record);
+    if (fprintf(stream, "%d,\"%s\",\"%s\",\"%s\"\n", record.id, record.name,
+                record.surname, record.city) < 0) {
+      delete zipf;
+      return -1;
+    }
+  }
+  delete zipf;
+  return 0;
+}
+
+/*
+ * Copies a quoted CSV field (without its quotes) into <dest>,
+ * unless it is too long for it
+ */
+static bool parse_string(char *field, char *dest, size_t size) {
+  if (field == NULL || *field != '"') {
+    return false;
+  }
+  field++;
+  size_t len = strlen(field);
+  if (len == 0 || field[len - 1] != '"' || len > size) {
+    return false;
+  }
+  field[len - 1] = 0;
+  strcpy(dest, field);
+  return true;
+}
+
+extern bool parse_dataset_line(char *line, Record *record) {
+  // Strip the line ending (either \n or \r\n)
+  size_t len = strlen(line);
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+    line[--len] = 0;
+  }
+  memset(record, 0, sizeof(*record));
+
+  char *field = strtok(line, ",");
+  if (field == NULL) {
+    return false;
+  }
+  record->id = atoi(field);
+  return parse_string(strtok(NULL, ","), record->name, sizeof(record->name)) &&
+         parse_string(strtok(NULL, ","), record->surname,
+                      sizeof(record->surname)) &&
+         parse_string(strtok(NULL, ","), record->city, sizeof(record->city));
+}
@@ -0,0 +1,375 @@
+#include "../headers/delta.h"
+#include "../headers/u_functions.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+/*
+ * Every file opened through Sorted_OpenFile(), along with
+ * the records inserted into it that have not been flushed yet
+ */
+struct OpenSortedFile {
+  std::string filename;
+  std::vector<Record> memtable;
+};
+
+static std::unordered_map<int, OpenSortedFile> open_files;
+
+/*
+ * The delta file names follow the format: <file>_Delta_<i>
+ */
+extern std::string delta_file_name(const char *filename, int delta) {
+  std::stringstream ss;
+  ss << filename << "_Delta_" << delta;
+  return ss.str();
+}
+
+extern void delta_register(int file_desc, const char *filename) {
+  OpenSortedFile file;
+  file.filename = filename;
+  open_files[file_desc] = file;
+}
+
+extern const char *delta_base_name(int file_desc) {
+  auto found = open_files.find(file_desc);
+  return found != open_files.end() ? found->second.filename.c_str() : NULL;
+}
+
+/*
+ * Returns the (not yet flushed) records inserted into the file,
+ * sorted by <fieldNo>
+ */
+extern std::vector<Record> delta_memtable(int file_desc, int fieldNo) {
+  auto found = open_files.find(file_desc);
+  if (found == open_files.end() || found->second.memtable.empty()) {
+    return std::vector<Record>();
+  }
+  std::vector<Record> records = found->second.memtable;
+  merge_sort(records.data(), 0, (int)records.size() - 1, fieldNo);
+  return records;
+}
+
+extern void source_open_file(SortedSource *source, int file_desc) {
+  source->file_desc = file_desc;
+  source->records = NULL;
+  source->max_blocks = BF_GetBlockCounter(file_desc);
+  source->block_num = first_data_block(read_block(file_desc, 0)) - 1;
+  source->rec_num = 0;
+  source->count = 0;
+}
+
+extern void source_open_records(SortedSource *source,
+                                const std::vector<Record> *records) {
+  source->file_desc = -1;
+  source->records = records;
+  source->rec_num = 0;
+  source->count = (int)records->size();
+}
+
+/*
+ * Reads the next record of the source. Blocks are copied out of the
+ * BF layer, so any number of sources can be read side by side.
+ * Returns false once the source has been exhausted
+ */
+extern bool source_next(SortedSource *source, Record *record) {
+  if (source->records != NULL) {
+    if (source->rec_num == source->count) {
+      return false;
+    }
+    *record = (*source->records)[source->rec_num++];
+    return true;
+  }
+
+  while (source->rec_num == source->count) {
+    if (++source->block_num >= source->max_blocks) {
+      return false;
+    }
+    memcpy(source->block, read_block(source->file_desc, source->block_num),
+           BLOCK_SIZE);
+    source->count = get_record_count(source->block);
+    source->rec_num = 0;
+  }
+  *record = get_record(source->rec_num++, source->block);
+  return true;
+}
+
+/*
+ * Orders the heap of a merge. On equal keys the source that comes first
+ * goes first
+ */
+static bool comes_after(const MergedSource *merged, int a, int b) {
+  const Record &rec_a = merged->current[a];
+  const Record &rec_b = merged->current[b];
+  if (checkLessThan(rec_b, rec_a, merged->fieldNo)) {
+    return true;
+  }
+  return !checkLessThan(rec_a, rec_b, merged->fieldNo) && a > b;
+}
+
+/*
+ * Starts the merge of <merged->sources> by <fieldNo>
+ */
+extern void merged_open(MergedSource *merged, int fieldNo) {
+  int num_sources = (int)merged->sources.size();
+  merged->fieldNo = fieldNo;
+  merged->current.resize((size_t)num_sources);
+  merged->heap.clear();
+  for (int i = 0; i < num_sources; i++) {
+    if (source_next(&merged->sources[i], &merged->current[i])) {
+      merged->heap.push_back(i);
+    }
+  }
+  std::make_heap(merged->heap.begin(), merged->heap.end(),
+                 [merged](int a, int b) { return comes_after(merged, a, b); });
+}
+
+/*
+ * Takes the next record out of the merge.
+ * Returns false once every source has been exhausted
+ */
+extern bool merged_next(MergedSource *merged, Record *record) {
+  std::vector<int> &heap = merged->heap;
+  auto after = [merged](int a, int b) { return comes_after(merged, a, b); };
+  if (heap.empty()) {
+    return false;
+  }
+  std::pop_heap(heap.begin(), heap.end(), after);
+  int next = heap.back();
+  *record = merged->current[next];
+  if (source_next(&merged->sources[next], &merged->current[next])) {
+    std::push_heap(heap.begin(), heap.end(), after);
+  } else {
+    heap.pop_back();
+  }
+  return true;
+}
+
+/*
+ * Merges the sorted <sources> by <fieldNo>, calling <emit> for every
+ * record in order. On equal keys the source that comes first goes first
+ */
+extern void merge_sources(std::vector<SortedSource> &sources, int fieldNo,
+                          void (*emit)(const Record &, void *), void *arg) {
+  MergedSource merged;
+  merged.sources.swap(sources);
+  merged_open(&merged, fieldNo);
+  Record record;
+  while (merged_next(&merged, &record)) {
+    emit(record, arg);
+  }
+  sources.swap(merged.sources);
+}
+
+static void add_to_output(const Record &record, void *out) {
+  sorted_output_add((SortedOutput *)out, record);
+}
+
+/*
+ * Opens the given files as merge sources (the descriptors are kept
+ * in <descs>, so that they can be closed afterwards)
+ */
+static int open_sources(const std::vector<std::string> &names,
+                        std::vector<SortedSource> &sources,
+                        std::vector<int> &descs) {
+  sources = std::vector<SortedSource>(names.size());
+  for (size_t i = 0; i < names.size(); i++) {
+    int file_desc;
+    if ((file_desc = BF_OpenFile(names[i].c_str())) < 0) {
+      BF_PrintError("Error opening delta file");
+      return -1;
+    }
+    descs.push_back(file_desc);
+    source_open_file(&sources[i], file_desc);
+  }
+  return 0;
+}
+
+static void close_sources(std::vector<int> &descs) {
+  for (int file_desc : descs) {
+    BF_CloseFile(file_desc);
+  }
+  descs.clear();
+}
+
+/*
+ * Merges the files <names> into the new sorted file <output>
+ */
+static int merge_files(const std::vector<std::string> &names,
+                       const std::string &output, int fieldNo,
+                       long num_records) {
+  std::vector<SortedSource> sources;
+  std::vector<int> descs;
+  if (open_sources(names, sources, descs) < 0) {
+    close_sources(descs);
+    return -1;
+  }
+
+  SortedOutput out;
+  if (sorted_output_open(&out, output.c_str(), fieldNo, num_records) < 0) {
+    close_sources(descs);
+    return -1;
+  }
+  merge_sources(sources, fieldNo, add_to_output, &out);
+  sorted_output_close(&out);
+  close_sources(descs);
+  return 0;
+}
+
+/*
+ * Merges the <num_deltas> deltas of <filename> into its first delta.
+ * The merged file is renamed over the first delta (an atomic replace),
+ * and the rest of the deltas are left for the caller to remove once the
+ * header no longer counts them
+ */
+static void merge_deltas(const std::string &filename, int num_deltas,
+                         int fieldNo, long num_records) {
+  std::vector<std::string> names;
+  for (int delta = 0; delta < num_deltas; delta++) {
+    names.push_back(delta_file_name(filename.c_str(), delta));
+  }
+  std::string merged = filename + "_Delta_Merge";
+  if (merge_files(names, merged, fieldNo, num_records) < 0 ||
+      rename(merged.c_str(), names[0].c_str()) != 0) {
+    std::cerr << "Error merging the delta files of " << filename << std::endl;
+    exit(1);
+  }
+}
+
+/*
+ * Writes the memtable of an open sorted file into a new delta
+ */
+extern void delta_flush(int file_desc) {
+  auto found = open_files.find(file_desc);
+  if (found == open_files.end() || found->second.memtable.empty()) {
+    return;
+  }
+  // Opening and closing the delta changes the open file table,
+  // so we take what we need out of it first
+  std::string filename = found->second.filename;
+  std::vector<Record> memtable;
+  memtable.swap(found->second.memtable);
+
+  void *header = read_block(file_desc, 0);
+  int fieldNo = *((int *)header + SORTED_BY_OFFSET);
+  int num_deltas = *((int *)header + DELTA_COUNT_OFFSET);
+  long delta_records = *((int *)header + DELTA_RECORDS_OFFSET);
+
+  merge_sort(memtable.data(), 0, (int)memtable.size() - 1, fieldNo);
+  std::string delta_name = delta_file_name(filename.c_str(), num_deltas);
+  SortedOutput out;
+  if (sorted_output_open(&out, delta_name.c_str(), fieldNo,
+                         (long)memtable.size()) < 0) {
+    std::cerr << "Error creating delta file " << delta_name << std::endl;
+    exit(1);
+  }
+  for (const Record &record : memtable) {
+    sorted_output_add(&out, record);
+  }
+  sorted_output_close(&out);
+  num_deltas++;
+  delta_records += (long)memtable.size();
+
+  int merged_deltas = 0;
+  if (num_deltas >= MAX_DELTA_FILES) {
+    merge_deltas(filename, num_deltas, fieldNo, delta_records);
+    merged_deltas = num_deltas;
+    num_deltas = 1;
+  }
+
+  header = read_block(file_desc, 0);
+  *((int *)header + DELTA_COUNT_OFFSET) = num_deltas;
+  *((int *)header + DELTA_RECORDS_OFFSET) = (int)delta_records;
+  write_block(file_desc, 0);
+
+  // The deltas merged into the first one go only once the header
+  // no longer counts them
+  for (int delta = 1; delta < merged_deltas; delta++) {
+    remove(delta_file_name(filename.c_str(), delta).c_str());
+  }
+}
+
+/*
+ * Keeps a record inserted into a sorted file, flushing the memtable
+ * once it is full
+ */
+extern int delta_insert(int file_desc, const Record &record) {
+  auto found = open_files.find(file_desc);
+  if (found == open_files.end()) {
+    std::cerr << "Sorted file was not opened with Sorted_OpenFile" << std::endl;
+    return -1;
+  }
+  found->second.memtable.push_back(record);
+  if ((int)found->second.memtable.size() >= MEMTABLE_RECORDS) {
+    delta_flush(file_desc);
+  }
+  return 0;
+}
+
+/*
+ * Flushes the memtable of a file that is being closed. Returns true
+ * (and the file's name) if its deltas should now be compacted
+ */
+extern bool delta_close(int file_desc, std::string *filename) {
+  if (open_files.count(file_desc) == 0) {
+    return false;
+  }
+  delta_flush(file_desc);
+  *filename = open_files[file_desc].filename;
+  open_files.erase(file_desc);
+
+  void *header = read_block(file_desc, 0);
+  if (*((int *)header + FILE_TYPE_OFFSET) != HEAP_FILE ||
+      *((int *)header + SORTED_FILE_OFFSET) != FILE_SORTED) {
+    return false;
+  }
+  int num_deltas = *((int *)header + DELTA_COUNT_OFFSET);
+  long delta_records = *((int *)header + DELTA_RECORDS_OFFSET);
+  long num_records = *((int *)header + RECORD_COUNT_OFFSET);
+  return num_deltas > 0 &&
+         delta_records * DELTA_COMPACTION_RATIO >= num_records;
+}
+
+/*
+ * Merges the deltas of the (closed) sorted file into a new base file,
+ * which then replaces the old one
+ */
+extern int delta_compact(const char *filename) {
+  int file_desc;
+  if ((file_desc = BF_OpenFile(filename)) < 0) {
+    BF_PrintError("Error opening file");
+    return -1;
+  }
+  void *header = read_block(file_desc, 0);
+  int fieldNo = *((int *)header + SORTED_BY_OFFSET);
+  int num_deltas = *((int *)header + DELTA_COUNT_OFFSET);
+  long num_records = (long)*((int *)header + RECORD_COUNT_OFFSET) +
+                     *((int *)header + DELTA_RECORDS_OFFSET);
+  BF_CloseFile(file_desc);
+  if (num_deltas == 0) {
+    return 0;
+  }
+
+  std::vector<std::string> names;
+  names.push_back(filename);
+  for (int delta = 0; delta < num_deltas; delta++) {
+    names.push_back(delta_file_name(filename, delta));
+  }
+  std::string compacted = std::string(filename) + "_Compact";
+  if (merge_files(names, compacted, fieldNo, num_records) < 0) {
+    return -1;
+  }
+  // The compacted file (which has no deltas) atomically replaces the base
+  // file, and only then are the old deltas removed
+  if (rename(compacted.c_str(), filename) != 0) {
+    perror("Error replacing the compacted file");
+    remove(compacted.c_str());
+    return -1;
+  }
+  for (size_t delta = 1; delta < names.size(); delta++) {
+    remove(names[delta].c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,258 @@
+#include "../headers/explain.h"
+#include "../headers/bloom.h"
+#include "../headers/merge_plan.h"
+#include "../headers/run_codec.h"
+#include "../headers/u_functions.h"
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+static long extents_of(long blocks) {
+  return (blocks + SPILL_EXTENT_BLOCKS - 1) / SPILL_EXTENT_BLOCKS;
+}
+
+/*
+ * Blocks read by the gather pass of SORT_MODE_KEYS (see explain.h).
+ * Out of order reads are stored in <random_reads>
+ */
+static long gather_reads(long data_blocks, long records, long window_blocks,
+                         long *random_reads) {
+  if (data_blocks <= window_blocks || window_blocks <= 0) {
+    *random_reads = 0;
+    return data_blocks;
+  }
+  double per_window =
+      -data_blocks * std::log(1.0 - (double)window_blocks / data_blocks);
+  long windows = (long)std::ceil(records / per_window);
+  *random_reads = windows * window_blocks;
+  return *random_reads;
+}
+
+/*
+ * Predicts the I/O of a sort of <data_blocks> heap file blocks
+ * (<records> records), whose runs need <run_ratio> blocks per heap block
+ */
+extern SortPrediction predict_sort(long data_blocks, long records,
+                                   double run_ratio, int mode, int fan_in,
+                                   const SortOptions *options) {
+  SortPrediction prediction = SortPrediction();
+  prediction.mode = mode;
+  prediction.fan_in = fan_in;
+  prediction.data_blocks = data_blocks;
+  prediction.records = records;
+
+  long memory_blocks = options->memory_blocks > 0 ? options->memory_blocks : 1;
+  // The BF layer reads every new block of the sorted file before writing it
+  long output_blocks = data_blocks + bloom_block_count(records);
+
+  // A records sort of a file that fits in memory needs no runs at all
+  if (mode == SORT_MODE_RECORDS && data_blocks <= memory_blocks &&
+      options->aggregate != SORT_AGGREGATE_GROUP_BY) {
+    prediction.blocks_read = data_blocks + output_blocks;
+    prediction.blocks_written = output_blocks;
+    prediction.cost = prediction.blocks_read + prediction.blocks_written;
+    return prediction;
+  }
+
+  long loads = (data_blocks + memory_blocks - 1) / memory_blocks;
+  std::vector<long> run_blocks;
+  long initial_blocks = 0;
+  long temp_extents = 0;
+  for (long load = 0; load < loads; load++) {
+    long load_blocks =
+        std::min(memory_blocks, data_blocks - load * memory_blocks);
+    long blocks = (long)std::ceil(load_blocks * run_ratio);
+    run_blocks.push_back(blocks);
+    initial_blocks += blocks;
+    temp_extents += extents_of(blocks);
+  }
+  prediction.runs = loads;
+  prediction.run_blocks = loads > 0 ? initial_blocks / loads : 0;
+
+  long merge_reads;
+  std::vector<MergeStep> plan = plan_merges(run_blocks, fan_in, &merge_reads);
+  prediction.merge_steps = (int)plan.size();
+  prediction.merge_passes =
+      initial_blocks > 0 ? (double)merge_reads / initial_blocks : 0;
+
+  // The spill file peaks while a merge's output and inputs are all live
+  std::vector<long> sizes = run_blocks;
+  long live_extents = temp_extents;
+  long peak_extents = live_extents;
+  for (const MergeStep &step : plan) {
+    long output = 0;
+    long input_extents = 0;
+    for (int input : step.inputs) {
+      output += sizes[input];
+      input_extents += extents_of(sizes[input]);
+    }
+    sizes.push_back(output);
+    live_extents += extents_of(output);
+    peak_extents = std::max(peak_extents, live_extents);
+    live_extents -= input_extents;
+  }
+  prediction.temp_peak_blocks = peak_extents * SPILL_EXTENT_BLOCKS;
+
+  prediction.blocks_read =
+      data_blocks + merge_reads + initial_blocks + output_blocks;
+  prediction.blocks_written = initial_blocks + merge_reads + output_blocks;
+  if (mode == SORT_MODE_KEYS) {
+    prediction.blocks_read += gather_reads(data_blocks, records,
+                                           options->gather_blocks,
+                                           &prediction.random_reads);
+  }
+  prediction.cost = prediction.blocks_read + prediction.blocks_written +
+                    (EXPLAIN_RANDOM_COST - 1) * (double)prediction.random_reads;
+  return prediction;
+}
+
+/*
+ * Encodes a sorted sample of the heap file into runs of whole records
+ * and of key entries, to find how many run blocks a heap file block needs
+ */
+static int sample_run_ratios(int file_desc, int first_block, int n,
+                             int fieldNo, const SortOptions *options,
+                             double *record_ratio, double *key_ratio,
+                             long *records) {
+  int sample_blocks = std::min(n - first_block, EXPLAIN_SAMPLE_BLOCKS);
+  std::vector<Record> sample;
+  std::vector<KeyEntry> keys;
+  Record buffer[BUFFER_SIZE];
+  for (int block_number = first_block;
+       block_number < first_block + sample_blocks; block_number++) {
+    int block_size;
+    fill_buffer(buffer, read_block(file_desc, block_number), &block_size);
+    for (int rec_num = 0; rec_num < block_size; rec_num++) {
+      sample.push_back(buffer[rec_num]);
+      keys.push_back(make_key_entry(buffer[rec_num], fieldNo, block_number,
+                                    rec_num));
+    }
+  }
+  *record_ratio = 1;
+  *key_ratio = 1;
+  *records = 0;
+  if (sample.empty()) {
+    return 0;
+  }
+  *records = (long)((double)sample.size() / sample_blocks * (n - first_block));
+  merge_sort(sample.data(), 0, (int)sample.size() - 1, fieldNo);
+  merge_sort(keys.data(), 0, (int)keys.size() - 1, fieldNo);
+
+  SpillFile spill;
+  if (spill_open(&spill, options->temp_dir, options->direct_io) < 0) {
+    return -1;
+  }
+  RunWriter writer;
+  run_writer_open(&writer, &spill, spill_create_run(&spill), fieldNo);
+  for (const Record &rec : sample) {
+    run_write(&writer, rec);
+  }
+  run_writer_close(&writer);
+  *record_ratio = (double)writer.blocks / sample_blocks;
+
+  run_writer_open(&writer, &spill, spill_create_run(&spill), fieldNo);
+  for (const KeyEntry &key : keys) {
+    run_write(&writer, key);
+  }
+  run_writer_close(&writer);
+  *key_ratio = (double)writer.blocks / sample_blocks;
+  spill_close(&spill);
+  return 0;
+}
+
+static void print_prediction(const SortPrediction &prediction, bool chosen) {
+  printf("%s %-7s fan-in %3d: %6ld runs, %4d merges (%.2f passes), "
+         "%9ld reads (%ld random), %9ld writes, %8ld temp blocks, cost %.0f\n",
+         chosen ? "*" : " ",
+         prediction.mode == SORT_MODE_KEYS ? "keys" : "records",
+         prediction.fan_in, prediction.runs, prediction.merge_steps,
+         prediction.merge_passes, prediction.blocks_read,
+         prediction.random_reads, prediction.blocks_written,
+         prediction.temp_peak_blocks, prediction.cost);
+}
+
+/*
+ * Predicts the cost of every sort configuration that fits the memory budget
+ * and open run limit of <options> (both modes, and every fan-in) and keeps
+ * the cheapest one in <plan>. On equal costs, the smaller fan-in wins
+ */
+extern int Sorted_ExplainSort(const char *filename, int fieldNo,
+                              const SortOptions *options, SortPlan *plan) {
+  if (fieldNo > 3 || fieldNo < 0) {
+    std::cerr << "Unknown field number. Exiting..." << std::endl;
+    return -1;
+  }
+  int file_desc;
+  if ((file_desc = BF_OpenFile(filename)) < 0) {
+    BF_PrintError("Error opening heap file");
+    return -1;
+  }
+  void *header = read_block(file_desc, 0);
+  if (*((int *)header + FILE_TYPE_OFFSET) != HEAP_FILE) {
+    std::cerr << "Given file is not a heap file. Exiting..." << std::endl;
+    BF_CloseFile(file_desc);
+    return -1;
+  }
+  int first_block = first_data_block(header);
+  int n = BF_GetBlockCounter(file_desc);
+  long records;
+  int result = sample_run_ratios(file_desc, first_block, n, fieldNo, options,
+                                 &plan->record_ratio, &plan->key_ratio,
+                                 &records);
+  BF_CloseFile(file_desc);
+  if (result < 0) {
+    return -1;
+  }
+
+  long data_blocks = n - first_block;
+  int max_fan_in = merge_fan_in(options->memory_blocks, options->max_open_runs,
+                                options->direct_io);
+  printf("Sort of %s by %s: %ld blocks, about %ld records\n", filename,
+         field_number_value(fieldNo).c_str(), data_blocks, records);
+
+  bool found = false;
+  std::vector<SortPrediction> predictions;
+  for (int mode = SORT_MODE_RECORDS; mode <= SORT_MODE_KEYS; mode++) {
+    double ratio = mode == SORT_MODE_KEYS ? plan->key_ratio : plan->record_ratio;
+    for (int fan_in = MERGE_MIN_FAN_IN; fan_in <= max_fan_in; fan_in++) {
+      SortPrediction prediction =
+          predict_sort(data_blocks, records, ratio, mode, fan_in, options);
+      predictions.push_back(prediction);
+      if (!found || prediction.cost < plan->prediction.cost) {
+        plan->prediction = prediction;
+        found = true;
+      }
+    }
+  }
+  for (const SortPrediction &prediction : predictions) {
+    print_prediction(prediction,
+                     prediction.mode == plan->prediction.mode &&
+                         prediction.fan_in == plan->prediction.fan_in);
+  }
+
+  plan->options = *options;
+  plan->options.mode = plan->prediction.mode;
+  plan->options.max_open_runs = plan->prediction.fan_in;
+  return 0;
+}
+
+/*
+ * Prints the predictions of <plan> next to the statistics of the sort
+ * that followed it
+ */
+extern void Sorted_ReportPlan(const SortPlan *plan, const SortStats *stats) {
+  const SortPrediction &prediction = plan->prediction;
+  printf("%-16s %12s %12s\n", "", "predicted", "actual");
+  printf("%-16s %12ld %12zu\n", "runs", prediction.runs,
+         stats->run_blocks.size());
+  printf("%-16s %12d %12d\n", "merge steps", prediction.merge_steps,
+         stats->merge_steps);
+  printf("%-16s %12.2f %12.2f\n", "merge passes", prediction.merge_passes,
+         stats->merge_passes);
+  printf("%-16s %12ld %12ld\n", "blocks read", prediction.blocks_read,
+         stats->totals.blocks_read);
+  printf("%-16s %12ld %12ld\n", "blocks written", prediction.blocks_written,
+         stats->totals.blocks_written);
+  printf("%-16s %12ld %12ld\n", "temp peak", prediction.temp_peak_blocks,
+         stats->temp_peak_blocks);
+}
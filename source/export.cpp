@@ -0,0 +1,319 @@
+#include "../headers/export.h"
+#include "../headers/delta.h"
+#include "../headers/u_functions.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// The fewest records worth a formatting thread of their own
+#define EXPORT_MIN_THREAD_RECORDS 4096
+
+#define RECORD_STRING_BYTES                                                    \
+  (sizeof(Record::name) + sizeof(Record::surname) + sizeof(Record::city))
+
+/*
+ * The most bytes a record can take in <format> (a string character takes
+ * up to 2 bytes in CSV, as a doubled quote, and up to 6 bytes in NDJSON,
+ * escaped as \u00XX)
+ */
+static size_t max_record_bytes(int format) {
+  switch (format) {
+  case EXPORT_FORMAT_CSV:
+    return 32 + 2 * RECORD_STRING_BYTES;
+  case EXPORT_FORMAT_NDJSON:
+    return 64 + 6 * RECORD_STRING_BYTES;
+  default:
+    return sizeof(Record);
+  }
+}
+
+static char *format_int(char *out, int value) {
+  unsigned int magnitude = (unsigned int)value;
+  if (value < 0) {
+    *out++ = '-';
+    magnitude = 0u - magnitude;
+  }
+  char digits[10];
+  int count = 0;
+  do {
+    digits[count++] = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0);
+  while (count > 0) {
+    *out++ = digits[--count];
+  }
+  return out;
+}
+
+/*
+ * Copies a string of a quoted CSV field, doubling its quotes
+ */
+static char *quote_field(char *out, const char *field, size_t size) {
+  for (size_t i = 0; i < size && field[i] != 0; i++) {
+    if (field[i] == '"') {
+      *out++ = '"';
+    }
+    *out++ = field[i];
+  }
+  return out;
+}
+
+static char *escape_field(char *out, const char *field, size_t size) {
+  static const char hex[] = "0123456789abcdef";
+  for (size_t i = 0; i < size && field[i] != 0; i++) {
+    unsigned char c = (unsigned char)field[i];
+    if (c == '"' || c == '\\') {
+      *out++ = '\\';
+      *out++ = (char)c;
+    } else if (c < 0x20) {
+      memcpy(out, "\\u00", 4);
+      out[4] = hex[c >> 4];
+      out[5] = hex[c & 15];
+      out += 6;
+    } else {
+      *out++ = (char)c;
+    }
+  }
+  return out;
+}
+
+/*
+ * Formats <rec> at <out>, which has room for max_record_bytes().
+ * Returns the end of the formatted record
+ */
+static char *format_record(char *out, const Record &rec, int format) {
+  if (format == EXPORT_FORMAT_BINARY) {
+    memcpy(out, &rec, sizeof(Record));
+    return out + sizeof(Record);
+  }
+  if (format == EXPORT_FORMAT_CSV) {
+    out = format_int(out, rec.id);
+    memcpy(out, ",\"", 2);
+    out = quote_field(out + 2, rec.name, sizeof(rec.name));
+    memcpy(out, "\",\"", 3);
+    out = quote_field(out + 3, rec.surname, sizeof(rec.surname));
+    memcpy(out, "\",\"", 3);
+    out = quote_field(out + 3, rec.city, sizeof(rec.city));
+    memcpy(out, "\"\n", 2);
+    return out + 2;
+  }
+  memcpy(out, "{\"id\":", 6);
+  out = format_int(out + 6, rec.id);
+  memcpy(out, ",\"name\":\"", 9);
+  out = escape_field(out + 9, rec.name, sizeof(rec.name));
+  memcpy(out, "\",\"surname\":\"", 13);
+  out = escape_field(out + 13, rec.surname, sizeof(rec.surname));
+  memcpy(out, "\",\"city\":\"", 10);
+  out = escape_field(out + 10, rec.city, sizeof(rec.city));
+  memcpy(out, "\"}\n", 3);
+  return out + 3;
+}
+
+/*
+ * Formats <count> records into <buffer> (which only grows).
+ * Returns the number of bytes used
+ */
+static size_t format_records(const Record *records, long count, int format,
+                             std::vector<char> *buffer) {
+  size_t bound = (size_t)count * max_record_bytes(format);
+  if (buffer->size() < bound) {
+    buffer->resize(bound);
+  }
+  char *out = buffer->data();
+  for (long i = 0; i < count; i++) {
+    out = format_record(out, records[i], format);
+  }
+  return (size_t)(out - buffer->data());
+}
+
+static int write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      perror("Error writing the export");
+      return -1;
+    }
+    data += written;
+    size -= (size_t)written;
+  }
+  return 0;
+}
+
+/*
+ * Exports blocks [first_block, n) of the file in batches (see export.h).
+ * Returns the number of records, or -1 on failure
+ */
+static long export_blocks(int file_desc, int first_block, int n, int fd,
+                          int format, int threads) {
+  std::vector<Record> batch((size_t)EXPORT_BATCH_BLOCKS * BUFFER_SIZE);
+  std::vector<std::vector<char>> buffers((size_t)threads);
+  std::vector<size_t> used((size_t)threads);
+  long records = 0;
+  for (int block_number = first_block; block_number < n;) {
+    long count = 0;
+    for (int loaded = 0; loaded < EXPORT_BATCH_BLOCKS && block_number < n;
+         loaded++, block_number++) {
+      int block_size;
+      fill_buffer(batch.data() + count, read_block(file_desc, block_number),
+                  &block_size);
+      count += block_size;
+    }
+
+    // Every thread formats an equal share of the batch
+    int workers = (int)std::min<long>(threads, count / EXPORT_MIN_THREAD_RECORDS);
+    if (workers <= 1) {
+      workers = 1;
+      used[0] = format_records(batch.data(), count, format, &buffers[0]);
+    } else {
+      std::vector<std::thread> formatters;
+      for (int t = 0; t < workers; t++) {
+        long lo = count * t / workers;
+        long hi = count * (t + 1) / workers;
+        formatters.emplace_back([&, t, lo, hi]() {
+          used[t] = format_records(batch.data() + lo, hi - lo, format,
+                                   &buffers[t]);
+        });
+      }
+      for (std::thread &formatter : formatters) {
+        formatter.join();
+      }
+    }
+    for (int t = 0; t < workers; t++) {
+      if (write_all(fd, buffers[t].data(), used[t]) < 0) {
+        return -1;
+      }
+    }
+    records += count;
+  }
+  return records;
+}
+
+/*
+ * The output of a merged export: records are formatted into one buffer,
+ * which is written whenever it fills up
+ */
+struct MergedExport {
+  int fd;
+  int format;
+  std::vector<char> buffer;
+  size_t used;
+  long records;
+  bool failed;
+};
+
+static void export_merged_record(const Record &record, void *arg) {
+  MergedExport *merged = (MergedExport *)arg;
+  if (merged->used + max_record_bytes(merged->format) > merged->buffer.size()) {
+    merged->failed = merged->failed ||
+                     write_all(merged->fd, merged->buffer.data(), merged->used) < 0;
+    merged->used = 0;
+  }
+  char *out = merged->buffer.data() + merged->used;
+  merged->used = (size_t)(format_record(out, record, merged->format) -
+                          merged->buffer.data());
+  merged->records++;
+}
+
+/*
+ * Exports a sorted file merged with its <num_deltas> deltas, in order.
+ * Returns the number of records, or -1 on failure
+ */
+static long export_merged(const char *filename, int file_desc, int fieldNo,
+                          int num_deltas, int fd, int format) {
+  std::vector<SortedSource> sources((size_t)num_deltas + 1);
+  std::vector<int> delta_descs;
+  source_open_file(&sources[0], file_desc);
+  for (int delta = 0; delta < num_deltas; delta++) {
+    int delta_desc;
+    if ((delta_desc = BF_OpenFile(delta_file_name(filename, delta).c_str())) <
+        0) {
+      BF_PrintError("Error opening delta file");
+      for (int desc : delta_descs) {
+        BF_CloseFile(desc);
+      }
+      return -1;
+    }
+    delta_descs.push_back(delta_desc);
+    source_open_file(&sources[delta + 1], delta_desc);
+  }
+
+  MergedExport merged;
+  merged.fd = fd;
+  merged.format = format;
+  merged.buffer.resize(EXPORT_BUFFER_BYTES + max_record_bytes(format));
+  merged.used = 0;
+  merged.records = 0;
+  merged.failed = false;
+  merge_sources(sources, fieldNo, export_merged_record, &merged);
+  for (int desc : delta_descs) {
+    BF_CloseFile(desc);
+  }
+  if (merged.failed || write_all(fd, merged.buffer.data(), merged.used) < 0) {
+    return -1;
+  }
+  return merged.records;
+}
+
+/*
+ * Bulk export of a heap or sorted file (see export.h)
+ */
+extern long Sorted_ExportFile(const char *filename, const char *output_name,
+                              const ExportOptions *options) {
+  int format = options->format;
+  if (format < EXPORT_FORMAT_CSV || format > EXPORT_FORMAT_BINARY) {
+    std::cerr << "Unknown export format. Exiting..." << std::endl;
+    return -1;
+  }
+  int file_desc;
+  if ((file_desc = BF_OpenFile(filename)) < 0) {
+    BF_PrintError("Error opening file");
+    return -1;
+  }
+  void *header = read_block(file_desc, 0);
+  if (*((int *)header + FILE_TYPE_OFFSET) != HEAP_FILE) {
+    std::cerr << "Given file is not a heap file. Exiting..." << std::endl;
+    BF_CloseFile(file_desc);
+    return -1;
+  }
+  bool sorted = *((int *)header + SORTED_FILE_OFFSET) == FILE_SORTED;
+  int sorted_by = *((int *)header + SORTED_BY_OFFSET);
+  int num_deltas = sorted ? *((int *)header + DELTA_COUNT_OFFSET) : 0;
+  int first_block = first_data_block(header);
+  int n = BF_GetBlockCounter(file_desc);
+
+  bool to_stdout = strcmp(output_name, "-") == 0;
+  int fd = STDOUT_FILENO;
+  if (to_stdout) {
+    // Whatever was printed before goes first
+    std::cout.flush();
+    fflush(stdout);
+  } else if ((fd = open(output_name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror("Error creating the export");
+    BF_CloseFile(file_desc);
+    return -1;
+  }
+
+  int threads = options->threads > 0
+                    ? options->threads
+                    : (int)std::thread::hardware_concurrency();
+  long records =
+      num_deltas > 0
+          ? export_merged(filename, file_desc, sorted_by, num_deltas, fd, format)
+          : export_blocks(file_desc, first_block, n, fd, format,
+                          std::max(threads, 1));
+  if (!to_stdout && close(fd) < 0) {
+    perror("Error closing the export");
+    records = -1;
+  }
+  BF_CloseFile(file_desc);
+  return records;
+}
@@ -0,0 +1,40 @@
+#include "../headers/dataset.h"
+#include <cstdlib>
+#include <iostream>
+
+/*
+ * Writes a synthetic dataset (see dataset.h):
+ *   gen_dataset <distribution> <records> <output csv> [seed]
+ */
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    std::cerr << "Usage: " << argv[0]
+              << " <distribution> <records> <output csv> [seed]" << std::endl
+              << "Distributions:";
+    for (int distribution = 0; distribution < DATASET_COUNT; distribution++) {
+      std::cerr << " " << dataset_name(distribution);
+    }
+    std::cerr << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  int distribution = dataset_distribution(argv[1]);
+  if (distribution < 0) {
+    std::cerr << "Unknown distribution: " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+  }
+  long records = atol(argv[2]);
+  unsigned long seed = argc > 4 ? strtoul(argv[4], NULL, 10) : 1;
+
+  FILE *stream = fopen(argv[3], "w");
+  if (stream == NULL) {
+    perror("Error creating the dataset");
+    return EXIT_FAILURE;
+  }
+  int result = write_dataset(stream, distribution, records, seed);
+  if (fclose(stream) != 0 || result < 0) {
+    std::cerr << "Error writing the dataset" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
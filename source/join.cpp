@@ -0,0 +1,218 @@
+#include "../headers/join.h"
+#include "../headers/u_functions.h"
+#include <iostream>
+
+/*
+ * One side of a join: a sorted file merged with its deltas, along with
+ * the descriptors to close afterwards
+ */
+struct JoinInput {
+  MergedSource merged;
+  std::vector<int> descs;
+};
+
+static void join_input_close(JoinInput *input) {
+  for (int file_desc : input->descs) {
+    BF_CloseFile(file_desc);
+  }
+  input->descs.clear();
+}
+
+/*
+ * Adds <filename> to the sources of a join input
+ */
+static int join_input_add(JoinInput *input, const char *filename) {
+  int file_desc;
+  if ((file_desc = BF_OpenFile(filename)) < 0) {
+    BF_PrintError("Error opening join input");
+    return -1;
+  }
+  input->descs.push_back(file_desc);
+  input->merged.sources.emplace_back();
+  source_open_file(&input->merged.sources.back(), file_desc);
+  return 0;
+}
+
+/*
+ * Opens one side of a join: the file itself (merged with its deltas) if it
+ * is already sorted by <fieldNo>, otherwise its sorted copy, which is
+ * created if needed
+ */
+static int join_input_open(const char *filename, int fieldNo,
+                           JoinInput *input) {
+  int file_desc;
+  if ((file_desc = BF_OpenFile(filename)) < 0) {
+    BF_PrintError("Error opening join input");
+    return -1;
+  }
+  void *header = read_block(file_desc, 0);
+  if (*((int *)header + FILE_TYPE_OFFSET) != HEAP_FILE) {
+    std::cerr << "Join input " << filename << " is not a heap file"
+              << std::endl;
+    BF_CloseFile(file_desc);
+    return -1;
+  }
+  bool sorted = *((int *)header + SORTED_FILE_OFFSET) == FILE_SORTED &&
+                *((int *)header + SORTED_BY_OFFSET) == fieldNo;
+  int num_deltas = sorted ? *((int *)header + DELTA_COUNT_OFFSET) : 0;
+  BF_CloseFile(file_desc);
+
+  int result = 0;
+  if (sorted) {
+    result = join_input_add(input, filename);
+    for (int delta = 0; delta < num_deltas && result == 0; delta++) {
+      result =
+          join_input_add(input, delta_file_name(filename, delta).c_str());
+    }
+  } else if ((result = Sorted_SortFile(filename, fieldNo)) == 0) {
+    char *sorted_file_name = get_sorted_file_name(filename, fieldNo);
+    result = join_input_add(input, sorted_file_name);
+    delete[] sorted_file_name;
+  }
+  if (result < 0) {
+    join_input_close(input);
+    return -1;
+  }
+  merged_open(&input->merged, fieldNo);
+  return 0;
+}
+
+/*
+ * The output of a join: joined records are buffered, and written into
+ * the output heap file as whole blocks
+ */
+struct JoinOutput {
+  int file_desc;
+  std::vector<Record> buffer;
+};
+
+static void join_output_flush(JoinOutput *out) {
+  flush_buffer(out->buffer.data(), out->file_desc, (int)out->buffer.size());
+  out->buffer.clear();
+}
+
+/*
+ * Writes a joined pair to the output
+ */
+static void emit_pair(JoinOutput *out, const Record &left,
+                      const Record &right) {
+  out->buffer.push_back(left);
+  out->buffer.push_back(right);
+  if ((int)out->buffer.size() >= JOIN_OUTPUT_RECORDS) {
+    join_output_flush(out);
+  }
+}
+
+/*
+ * Joins every left record with the key of <group> with the right records
+ * of the key: the ones buffered in <group>, and (if the group did not fit)
+ * the rest of them, which are read again starting at <rest>.
+ * <left> is left at the first record with a greater key.
+ * Returns the number of pairs
+ */
+static long join_group(MergedSource *left_source, Record *left,
+                       bool *has_left, const std::vector<Record> &group,
+                       const MergedSource *rest, bool overflow, int fieldNo,
+                       JoinOutput *out) {
+  long pairs = 0;
+  while (*has_left && checkEqual(*left, group[0], fieldNo)) {
+    for (const Record &right : group) {
+      emit_pair(out, *left, right);
+      pairs++;
+    }
+    if (overflow) {
+      MergedSource source = *rest;
+      Record right;
+      while (merged_next(&source, &right) &&
+             checkEqual(right, group[0], fieldNo)) {
+        emit_pair(out, *left, right);
+        pairs++;
+      }
+    }
+    *has_left = merged_next(left_source, left);
+  }
+  return pairs;
+}
+
+/*
+ * Sort-merge join (see join.h)
+ */
+extern long Sorted_MergeJoin(const char *fileA, const char *fileB,
+                             int fieldNo) {
+  if (fieldNo > 3 || fieldNo < 0) {
+    std::cerr << "Unknown field number. Exiting..." << std::endl;
+    return -1;
+  }
+  JoinInput left_input, right_input;
+  if (join_input_open(fileA, fieldNo, &left_input) < 0) {
+    return -1;
+  }
+  if (join_input_open(fileB, fieldNo, &right_input) < 0) {
+    join_input_close(&left_input);
+    return -1;
+  }
+
+  char *join_file_name = get_join_file_name(fileA, fileB, fieldNo);
+  JoinOutput out;
+  if (Sorted_CreateFile(join_file_name) < 0 ||
+      (out.file_desc = Sorted_OpenFile(join_file_name)) < 0) {
+    join_input_close(&left_input);
+    join_input_close(&right_input);
+    delete[] join_file_name;
+    return -1;
+  }
+  out.buffer.reserve(JOIN_OUTPUT_RECORDS + 1);
+
+  // Merged sources copy every block out of the BF layer, so a source can
+  // be saved and read again from the same position later on
+  MergedSource &left_source = left_input.merged;
+  MergedSource &right_source = right_input.merged;
+
+  Record left, right;
+  bool has_left = merged_next(&left_source, &left);
+  bool has_right = merged_next(&right_source, &right);
+  std::vector<Record> group;
+  long pairs = 0;
+  while (has_left && has_right) {
+    if (checkLessThan(left, right, fieldNo)) {
+      has_left = merged_next(&left_source, &left);
+      continue;
+    }
+    if (checkLessThan(right, left, fieldNo)) {
+      has_right = merged_next(&right_source, &right);
+      continue;
+    }
+
+    // Buffer the right side's records with the key. If there are too
+    // many of them, we remember where the buffered ones end
+    group.clear();
+    MergedSource rest;
+    bool overflow = false;
+    do {
+      group.push_back(right);
+      if ((int)group.size() == JOIN_GROUP_RECORDS) {
+        rest = right_source;
+      }
+      has_right = merged_next(&right_source, &right);
+    } while (has_right && checkEqual(right, group[0], fieldNo) &&
+             (int)group.size() < JOIN_GROUP_RECORDS);
+    if (has_right && checkEqual(right, group[0], fieldNo)) {
+      overflow = true;
+      while (has_right && checkEqual(right, group[0], fieldNo)) {
+        has_right = merged_next(&right_source, &right);
+      }
+    }
+
+    pairs += join_group(&left_source, &left, &has_left, group, &rest,
+                        overflow, fieldNo, &out);
+  }
+
+  std::cout << "Joined " << pairs << " pairs into " << join_file_name
+            << std::endl;
+  join_output_flush(&out);
+  Sorted_CloseFile(out.file_desc);
+  join_input_close(&left_input);
+  join_input_close(&right_input);
+  delete[] join_file_name;
+  return pairs;
+}
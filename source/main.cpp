@@ -1,3 +1,4 @@
+#include "../headers/buffer_pool.h"
 #include "../headers/sorted.h"
 #include "../headers/u_functions.h"
 #include <assert.h>
@@ -11,10 +12,22 @@ void create_file(char *fileName) { assert(!Sorted_CreateFile(fileName)); }
 
 int open_file(const char *fileName) {
   int file_desc;
-  assert((file_desc = Sorted_OpenFile(fileName)) > 0);
+  assert((file_desc = Sorted_OpenFile(fileName)) >= 0);
   return file_desc;
 }
 
+// Copies a field into the record, unless it is too long to be kept whole
+bool copy_field(char *dest, const char *value, size_t size,
+                const char *field, int id) {
+  if (strlen(value) >= size) {
+    std::cerr << "Skipping record " << id << ": its " << field
+              << " is longer than " << size - 1 << " characters" << std::endl;
+    return false;
+  }
+  strcpy(dest, value);
+  return true;
+}
+
 void insert_Entries(int file_desc, char *csv) {
   FILE *stream = fopen(csv, "rw");
   char *line = NULL;
@@ -22,7 +35,11 @@ void insert_Entries(int file_desc, char *csv) {
   ssize_t read;
   Record record;
   while ((read = getline(&line, &len, stream)) != -1) {
-    line[read - 2] = 0;
+    // Strip the line ending (either \n or \r\n)
+    while (read > 0 && (line[read - 1] == '\n' || line[read - 1] == '\r')) {
+      line[--read] = 0;
+    }
+    memset(&record, 0, sizeof(record));
     char *pch;
 
     pch = strtok(line, ",");
@@ -31,17 +48,25 @@ void insert_Entries(int file_desc, char *csv) {
     pch = strtok(NULL, ",");
     pch++;
     pch[strlen(pch) - 1] = 0;
-    strncpy(record.name, pch, sizeof(record.name));
+    if (!copy_field(record.name, pch, sizeof(record.name), "name", record.id)) {
+      continue;
+    }
 
     pch = strtok(NULL, ",");
     pch++;
     pch[strlen(pch) - 1] = 0;
-    strncpy(record.surname, pch, sizeof(record.surname));
+    if (!copy_field(record.surname, pch, sizeof(record.surname), "surname",
+                    record.id)) {
+      continue;
+    }
 
     pch = strtok(NULL, ",");
     pch++;
     pch[strlen(pch) - 1] = 0;
-    strncpy(record.city, pch, sizeof(record.city));
+    if (!copy_field(record.city, pch, sizeof(record.city), "city",
+                    record.id)) {
+      continue;
+    }
 
     Sorted_InsertEntry(file_desc, record);
   }
@@ -62,6 +87,7 @@ int main(int argc, char **argv) {
   system("exec mkdir ./io_files");
 
   BF_Init();
+  Pool_Init(POOL_DEFAULT_CAPACITY, POOL_DEFAULT_SHARDS);
 
   // -- create index
   char *filename = new char[50];
@@ -91,6 +117,7 @@ int main(int argc, char **argv) {
   file_desc = Sorted_OpenFile(filename);
   int fieldNo = 0;
   get_AllEntries(file_desc, &fieldNo, &value);
+  Pool_PrintStats();
 
   Sorted_CloseFile(file_desc);
 
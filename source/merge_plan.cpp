@@ -0,0 +1,76 @@
+#include "../headers/merge_plan.h"
+#include "../headers/spill.h"
+
+/*
+ * Every input run needs one block in memory, and so does the output run
+ * (one extent in direct mode)
+ */
+extern int merge_fan_in(long memory_blocks, int max_open_runs, bool direct) {
+  long buffers = direct ? memory_blocks / SPILL_EXTENT_BLOCKS : memory_blocks;
+  long fan_in = buffers - 1;
+  if (fan_in > max_open_runs) {
+    fan_in = max_open_runs;
+  }
+  return fan_in < MERGE_MIN_FAN_IN ? MERGE_MIN_FAN_IN : (int)fan_in;
+}
+
+/*
+ * Plans the merges of runs of <run_blocks> blocks each, with at most
+ * <fan_in> runs per merge. The number of blocks that the merges will read
+ * is stored in <blocks_read>
+ */
+extern std::vector<MergeStep> plan_merges(const std::vector<long> &run_blocks,
+                                          int fan_in, long *blocks_read) {
+  std::vector<MergeStep> steps;
+  std::vector<int> runs;
+  std::vector<long> sizes;
+  for (int run = 0; run < (int)run_blocks.size(); run++) {
+    runs.push_back(run);
+    sizes.push_back(run_blocks[run]);
+  }
+  *blocks_read = 0;
+
+  // With n runs, a first merge of ((n - 2) mod (k - 1)) + 2 runs leaves
+  // exactly enough runs for full k-way merges from then on
+  int num_runs = (int)runs.size();
+  int take = num_runs > fan_in ? (num_runs - 2) % (fan_in - 1) + 2 : num_runs;
+  int next_run = num_runs;
+
+  while (runs.size() > 1) {
+    if (take > (int)runs.size()) {
+      take = (int)runs.size();
+    }
+
+    // Find the <take> adjacent runs with the fewest blocks
+    long window = 0;
+    for (int i = 0; i < take; i++) {
+      window += sizes[i];
+    }
+    long best = window;
+    int best_start = 0;
+    for (int start = 1; start + take <= (int)runs.size(); start++) {
+      window += sizes[start + take - 1] - sizes[start - 1];
+      if (window < best) {
+        best = window;
+        best_start = start;
+      }
+    }
+
+    MergeStep step;
+    step.inputs.assign(runs.begin() + best_start,
+                       runs.begin() + best_start + take);
+    step.output = next_run++;
+    steps.push_back(step);
+    *blocks_read += best;
+
+    // The merged runs are replaced by the output run
+    runs.erase(runs.begin() + best_start, runs.begin() + best_start + take);
+    sizes.erase(sizes.begin() + best_start, sizes.begin() + best_start + take);
+    runs.insert(runs.begin() + best_start, step.output);
+    sizes.insert(sizes.begin() + best_start, best);
+
+    take = fan_in;
+  }
+
+  return steps;
+}
@@ -0,0 +1,333 @@
+#include "../headers/multi_sort.h"
+#include "../headers/arena.h"
+#include "../headers/delta.h"
+#include "../headers/merge_plan.h"
+#include "../headers/run_codec.h"
+#include "../headers/spill.h"
+#include "../headers/u_functions.h"
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/*
+ * One field of the sort: its initial runs, in input order, their sizes
+ * and the plan that merges them
+ */
+struct FieldRuns {
+  int fieldNo;
+  std::vector<int> runs;
+  std::vector<long> run_blocks;
+  std::vector<MergeStep> plan;
+};
+
+/*
+ * Points <refs> at the <size> records of the load, in input order
+ * (so that the sort stays stable), and sorts them by <fieldNo>
+ */
+static void sort_refs(const Record *load, int size, int fieldNo,
+                      RecordRef *refs, RecordRef *scratch, int threads) {
+  for (int i = 0; i < size; i++) {
+    refs[i].record = &load[i];
+  }
+  parallel_merge_sort(refs, size, fieldNo, scratch, threads);
+}
+
+/*
+ * Writes the records of a load, in the order of <refs>,
+ * into a new run of <field>
+ */
+static void write_field_run(SpillFile *spill, SortArena *arena,
+                            const RecordRef *refs, int size,
+                            FieldRuns *field) {
+  RunWriter &writer = arena->writer;
+  int run = spill_create_run(spill);
+  run_writer_open(&writer, spill, run, field->fieldNo);
+  for (int i = 0; i < size; i++) {
+    run_write(&writer, *refs[i].record);
+  }
+  run_writer_close(&writer);
+  field->runs.push_back(run);
+  field->run_blocks.push_back(writer.blocks);
+}
+
+/*
+ * Writes the sorted file of <fieldNo> straight from a load that holds
+ * the whole heap file, in the order of <refs>.
+ * Returns the number of records written, or -1 on failure
+ */
+static long write_sorted_refs(const char *filename, int fieldNo,
+                              const RecordRef *refs, int size) {
+  char *sorted_file_name = get_sorted_file_name(filename, fieldNo);
+  SortedOutput out;
+  long written = -1;
+  if (sorted_output_open(&out, sorted_file_name, fieldNo, size) == 0) {
+    for (int i = 0; i < size; i++) {
+      sorted_output_add(&out, *refs[i].record);
+    }
+    sorted_output_close(&out);
+    written = out.num_records;
+  }
+  delete[] sorted_file_name;
+  return written;
+}
+
+/*
+ * Runs the merge plan of a field (its outputs are appended to its runs,
+ * so that the plan's run numbers are their indexes) and decodes the last
+ * run into the field's sorted file.
+ * Returns the number of records written, or -1 on failure
+ */
+static long merge_field(const char *filename, SpillFile *spill,
+                        SortArena *arena, long total_records,
+                        FieldRuns *field) {
+  int fieldNo = field->fieldNo;
+  std::string field_name = field_number_value(fieldNo);
+  char phase_name[SORT_PHASE_NAME_SIZE];
+  for (size_t i = 0; i < field->plan.size(); i++) {
+    snprintf(phase_name, sizeof(phase_name), "merge %zu (%s)", i + 1,
+             field_name.c_str());
+    stats_begin_phase(phase_name);
+    std::vector<int> inputs;
+    for (int input : field->plan[i].inputs) {
+      inputs.push_back(field->runs[input]);
+    }
+    int outp_run = spill_create_run(spill);
+    merge_into_run(spill, inputs, outp_run, fieldNo, 0, false, arena);
+    for (int input : inputs) {
+      spill_free_run(spill, input);
+    }
+    field->runs.push_back(outp_run);
+  }
+
+  snprintf(phase_name, sizeof(phase_name), "output (%s)", field_name.c_str());
+  stats_begin_phase(phase_name);
+  char *sorted_file_name = get_sorted_file_name(filename, fieldNo);
+  SortedOutput out;
+  if (sorted_output_open(&out, sorted_file_name, fieldNo, total_records) < 0) {
+    delete[] sorted_file_name;
+    return -1;
+  }
+  RunReader *reader = arena_readers(arena, 1);
+  run_reader_open(reader, spill, field->runs.back(), fieldNo);
+  Record rec;
+  while (run_read(reader, &rec)) {
+    sorted_output_add(&out, rec);
+  }
+  sorted_output_close(&out);
+
+  // The space of the last run is reused by the next field's merges
+  spill_free_run(spill, field->runs.back());
+  delete[] sorted_file_name;
+  return out.num_records;
+}
+
+/*
+ * Sorts a given heap file by every field of <fields> (see multi_sort.h).
+ * Its statistics are kept in <stats>
+ */
+static int sort_fields(const char *filename, std::vector<FieldRuns> &fields,
+                       const SortOptions *options, SortStats *stats) {
+  std::cout << "Sorting file: " << filename << std::endl;
+  // The sort only reads the file's own blocks, so the deltas of a sorted
+  // file are merged into it first (see delta.h)
+  if (delta_compact(filename) < 0) {
+    return -1;
+  }
+  int file_desc;
+  if ((file_desc = BF_OpenFile(filename)) < 0) {
+    BF_PrintError("Error opening heap file");
+    return -1;
+  }
+  void *beginning = read_block(file_desc, 0);
+  if (*((int *)beginning + FILE_TYPE_OFFSET) != HEAP_FILE) {
+    std::cerr << "Given file is not a heap file. Exiting..." << std::endl;
+    BF_CloseFile(file_desc);
+    return -1;
+  }
+  int first_block = first_data_block(beginning);
+  int n = BF_GetBlockCounter(file_desc);
+  long data_blocks = n - first_block;
+  long memory_blocks = options->memory_blocks > 0 ? options->memory_blocks : 1;
+  int threads = options->threads > 0
+                    ? options->threads
+                    : (int)std::thread::hardware_concurrency();
+
+  // The load and the references of one field (along with their scratch
+  // space) are the whole arena. They are given back once the runs have
+  // been generated, and the merges reuse their space
+  long capacity =
+      (data_blocks < memory_blocks ? data_blocks : memory_blocks) * BUFFER_SIZE;
+  if (capacity == 0) {
+    capacity = 1;
+  }
+  SortArena arena;
+  arena_open(&arena, arena_bytes(capacity * sizeof(Record)) +
+                         2 * arena_bytes(capacity * sizeof(RecordRef)));
+  ArenaMark mark = arena_mark(&arena);
+  Record *load = arena_array<Record>(&arena, capacity);
+  RecordRef *refs = arena_array<RecordRef>(&arena, capacity);
+  RecordRef *scratch = arena_array<RecordRef>(&arena, capacity);
+  int result = 0;
+  stats->output_records = 0;
+
+  // A heap file that fits in memory is loaded once, and every sorted
+  // file is written straight from the load
+  if (data_blocks <= memory_blocks) {
+    stats_expect_blocks(data_blocks);
+    stats_begin_phase("load");
+    int size = 0;
+    for (int block_number = first_block; block_number < n; block_number++) {
+      int block_size;
+      fill_buffer(load + size, read_block(file_desc, block_number),
+                  &block_size);
+      size += block_size;
+    }
+    stats->input_records = size;
+    char phase_name[SORT_PHASE_NAME_SIZE];
+    for (FieldRuns &field : fields) {
+      snprintf(phase_name, sizeof(phase_name), "sort (%s)",
+               field_number_value(field.fieldNo).c_str());
+      stats_begin_phase(phase_name);
+      sort_refs(load, size, field.fieldNo, refs, scratch, threads);
+      snprintf(phase_name, sizeof(phase_name), "output (%s)",
+               field_number_value(field.fieldNo).c_str());
+      stats_begin_phase(phase_name);
+      long written = write_sorted_refs(filename, field.fieldNo, refs, size);
+      if (written < 0) {
+        result = -1;
+        break;
+      }
+      stats->output_records += written;
+    }
+    BF_CloseFile(file_desc);
+    arena_close(&arena);
+    return result;
+  }
+
+  SpillFile spill;
+  if (spill_open(&spill, options->temp_dir, options->direct_io) < 0) {
+    BF_CloseFile(file_desc);
+    arena_close(&arena);
+    return -1;
+  }
+
+  // Until the merges are planned, we expect to read the file once,
+  // and the runs of every field once more
+  int num_fields = (int)fields.size();
+  stats_expect_blocks((1 + num_fields) * data_blocks);
+  stats_begin_phase("run generation");
+  long total_records = 0;
+  for (int block_number = first_block; block_number < n;) {
+    int load_size = 0;
+    for (long loaded = 0; loaded < memory_blocks && block_number < n;
+         loaded++, block_number++) {
+      int block_size;
+      fill_buffer(load + load_size, read_block(file_desc, block_number),
+                  &block_size);
+      load_size += block_size;
+    }
+    if (load_size == 0) {
+      continue;
+    }
+    for (FieldRuns &field : fields) {
+      sort_refs(load, load_size, field.fieldNo, refs, scratch, threads);
+      write_field_run(&spill, &arena, refs, load_size, &field);
+    }
+    total_records += load_size;
+  }
+  stats->input_records = total_records;
+  arena_release(&arena, mark);
+
+  // Every field has its own plan (its runs differ only in their size)
+  long initial_blocks = 0;
+  long merge_blocks = 0;
+  stats->run_blocks.clear();
+  stats->merge_steps = 0;
+  int fan_in = merge_fan_in(memory_blocks, options->max_open_runs,
+                            options->direct_io);
+  for (FieldRuns &field : fields) {
+    // An empty heap file still gets (empty) sorted files
+    if (field.runs.empty()) {
+      field.runs.push_back(spill_create_run(&spill));
+      field.run_blocks.push_back(0);
+    }
+    long blocks_read;
+    field.plan = plan_merges(field.run_blocks, fan_in, &blocks_read);
+    for (long blocks : field.run_blocks) {
+      initial_blocks += blocks;
+      stats->run_blocks.push_back(blocks);
+    }
+    merge_blocks += blocks_read;
+    stats->merge_steps += (int)field.plan.size();
+  }
+  stats->merge_passes =
+      initial_blocks > 0 ? (double)merge_blocks / initial_blocks : 0;
+  stats_expect_blocks(data_blocks + merge_blocks + initial_blocks);
+
+  for (FieldRuns &field : fields) {
+    long written =
+        merge_field(filename, &spill, &arena, total_records, &field);
+    if (written < 0) {
+      result = -1;
+      break;
+    }
+    stats->output_records += written;
+  }
+  stats->temp_peak_blocks = spill.num_extents * SPILL_EXTENT_BLOCKS;
+
+  spill_close(&spill);
+  BF_CloseFile(file_desc);
+  arena_close(&arena);
+  return result;
+}
+
+/*
+ * Sorts a given heap file by several fields in one scan (see sort_fields()),
+ * keeping the statistics of the whole sort in <options->stats> and/or
+ * writing them to <options->stats_json>
+ */
+extern int Sorted_SortFileByFields(const char *filename, const int *fields,
+                                   int num_fields,
+                                   const SortOptions *options) {
+  if (num_fields < 1 || num_fields > MAX_SORT_FIELDS) {
+    std::cerr << "The number of fields must be between 1 and "
+              << MAX_SORT_FIELDS << std::endl;
+    return -1;
+  }
+  std::vector<FieldRuns> field_runs((size_t)num_fields);
+  for (int i = 0; i < num_fields; i++) {
+    if (fields[i] > 3 || fields[i] < 0) {
+      std::cerr << "Unknown field number. Exiting..." << std::endl;
+      return -1;
+    }
+    for (int j = 0; j < i; j++) {
+      if (fields[j] == fields[i]) {
+        std::cerr << "Every field must be given only once" << std::endl;
+        return -1;
+      }
+    }
+    field_runs[i].fieldNo = fields[i];
+  }
+  if (options->limit > 0 || options->aggregate != SORT_AGGREGATE_NONE ||
+      options->checkpoint_dir != NULL) {
+    std::cerr << "Multi-field sorts support neither limits, aggregates "
+                 "nor checkpoints"
+              << std::endl;
+    return -1;
+  }
+
+  SortStats local_stats;
+  SortStats *stats = options->stats != NULL ? options->stats : &local_stats;
+  stats_begin_sort(stats, options->progress, options->progress_arg,
+                   options->progress_interval);
+  int result = sort_fields(filename, field_runs, options, stats);
+  if (options->direct_io) {
+    drop_page_cache(filename);
+  }
+  stats_end_sort();
+  if (result == 0 && options->stats_json != NULL) {
+    result = stats_write_json(stats, options->stats_json);
+  }
+  return result;
+}
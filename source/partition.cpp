@@ -0,0 +1,244 @@
+#include "../headers/partition.h"
+#include "../headers/delta.h"
+#include "../headers/u_functions.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Sorts a sample of the heap file and picks the <partitions> - 1 keys
+ * that split it into equal parts
+ */
+extern std::vector<Record> pick_splitters(int file_desc, int fieldNo,
+                                          int partitions) {
+  int first_block = first_data_block(read_block(file_desc, 0));
+  int n = BF_GetBlockCounter(file_desc);
+  int data_blocks = n - first_block;
+  int step = data_blocks > PARTITION_SAMPLE_BLOCKS
+                 ? data_blocks / PARTITION_SAMPLE_BLOCKS
+                 : 1;
+
+  std::vector<Record> sample;
+  Record buffer[BUFFER_SIZE];
+  for (int block_number = first_block; block_number < n;
+       block_number += step) {
+    int block_size;
+    fill_buffer(buffer, read_block(file_desc, block_number), &block_size);
+    sample.insert(sample.end(), buffer, buffer + block_size);
+  }
+
+  std::vector<Record> splitters;
+  if (sample.empty()) {
+    return splitters;
+  }
+  merge_sort(sample.data(), 0, (int)sample.size() - 1, fieldNo);
+  for (int part = 1; part < partitions; part++) {
+    splitters.push_back(sample[sample.size() * part / partitions]);
+  }
+  return splitters;
+}
+
+/*
+ * The partition of a record is the number of splitters
+ * that are not greater than its key
+ */
+extern int partition_of(const Record &rec, const std::vector<Record> &splitters,
+                        int fieldNo) {
+  int l = 0, r = (int)splitters.size();
+  while (l < r) {
+    int m = (l + r) / 2;
+    if (checkLessThan(rec, splitters[m], fieldNo)) {
+      r = m;
+    } else {
+      l = m + 1;
+    }
+  }
+  return l;
+}
+
+/*
+ * Scatters the records of the heap file into the heap files of their
+ * partitions, in file order.
+ * Returns 0 on success, -1 otherwise
+ */
+static int scatter_partitions(int file_desc, const char *filename,
+                              int fieldNo, int partitions,
+                              const std::vector<Record> &splitters) {
+  std::vector<int> part_descs;
+  for (int part = 0; part < partitions; part++) {
+    char *part_file_name = get_partition_file_name(filename, part);
+    int part_desc = -1;
+    if (Sorted_CreateFile(part_file_name) < 0 ||
+        (part_desc = Sorted_OpenFile(part_file_name)) < 0) {
+      delete[] part_file_name;
+      for (int desc : part_descs) {
+        Sorted_CloseFile(desc);
+      }
+      return -1;
+    }
+    delete[] part_file_name;
+    part_descs.push_back(part_desc);
+  }
+
+  std::vector<std::vector<Record>> buffers((size_t)partitions);
+  int first_block = first_data_block(read_block(file_desc, 0));
+  int n = BF_GetBlockCounter(file_desc);
+  Record buffer[BUFFER_SIZE];
+  for (int block_number = first_block; block_number < n; block_number++) {
+    int block_size;
+    fill_buffer(buffer, read_block(file_desc, block_number), &block_size);
+    for (int rec_num = 0; rec_num < block_size; rec_num++) {
+      int part = partition_of(buffer[rec_num], splitters, fieldNo);
+      std::vector<Record> &part_buffer = buffers[part];
+      part_buffer.push_back(buffer[rec_num]);
+      if ((int)part_buffer.size() == PARTITION_BUFFER_RECORDS) {
+        flush_buffer(part_buffer.data(), part_descs[part],
+                     (int)part_buffer.size());
+        part_buffer.clear();
+      }
+    }
+  }
+  for (int part = 0; part < partitions; part++) {
+    flush_buffer(buffers[part].data(), part_descs[part],
+                 (int)buffers[part].size());
+    Sorted_CloseFile(part_descs[part]);
+  }
+  return 0;
+}
+
+/*
+ * The work of a single worker process: sorts partition <part>.
+ * Returns 0 on success, -1 otherwise
+ */
+static int sort_partition(const char *filename, int fieldNo, int part,
+                          const SortOptions *options) {
+  char *part_file_name = get_partition_file_name(filename, part);
+  // The unsorted partition is only needed by the sort
+  int result = Sorted_SortFileWithOptions(part_file_name, fieldNo, options);
+  remove(part_file_name);
+  delete[] part_file_name;
+  return result;
+}
+
+/*
+ * Writes the manifest of the sorted partitions
+ */
+static int write_manifest(const char *filename, int fieldNo, int partitions) {
+  char *manifest_name = get_manifest_file_name(filename, fieldNo);
+  FILE *manifest = fopen(manifest_name, "w");
+  delete[] manifest_name;
+  if (manifest == NULL) {
+    perror("Error creating the manifest");
+    return -1;
+  }
+
+  for (int part = 0; part < partitions; part++) {
+    char *part_file_name = get_partition_file_name(filename, part);
+    char *sorted_file_name = get_sorted_file_name(part_file_name, fieldNo);
+    int file_desc;
+    if ((file_desc = BF_OpenFile(sorted_file_name)) < 0) {
+      BF_PrintError("Error opening partition");
+      fclose(manifest);
+      delete[] part_file_name;
+      delete[] sorted_file_name;
+      return -1;
+    }
+    int num_records = *((int *)read_block(file_desc, 0) + RECORD_COUNT_OFFSET);
+    BF_CloseFile(file_desc);
+    fprintf(manifest, "%s %d\n", sorted_file_name, num_records);
+    delete[] part_file_name;
+    delete[] sorted_file_name;
+  }
+  fclose(manifest);
+  return 0;
+}
+
+/*
+ * Range-partitioned sort (see partition.h)
+ */
+extern int Sorted_ParallelSortFile(const char *filename, int fieldNo,
+                                   int partitions, const SortOptions *options) {
+  if (fieldNo > 3 || fieldNo < 0) {
+    std::cerr << "Unknown field number. Exiting..." << std::endl;
+    return -1;
+  }
+  if (partitions < 1 || partitions > MAX_PARTITIONS) {
+    std::cerr << "The number of partitions must be between 1 and "
+              << MAX_PARTITIONS << std::endl;
+    return -1;
+  }
+  if (options->limit > 0 || options->aggregate != SORT_AGGREGATE_NONE) {
+    std::cerr << "Partitioned sorts support neither limits nor aggregates"
+              << std::endl;
+    return -1;
+  }
+
+  // The sort only reads the file's own blocks, so the deltas of a sorted
+  // file are merged into it first (see delta.h)
+  if (delta_compact(filename) < 0) {
+    return -1;
+  }
+  int file_desc;
+  if ((file_desc = BF_OpenFile(filename)) < 0) {
+    BF_PrintError("Error opening heap file");
+    return -1;
+  }
+  if (*((int *)read_block(file_desc, 0) + FILE_TYPE_OFFSET) != HEAP_FILE) {
+    std::cerr << "Given file is not a heap file. Exiting..." << std::endl;
+    BF_CloseFile(file_desc);
+    return -1;
+  }
+  std::vector<Record> splitters =
+      pick_splitters(file_desc, fieldNo, partitions);
+  int scattered =
+      scatter_partitions(file_desc, filename, fieldNo, partitions, splitters);
+  BF_CloseFile(file_desc);
+  if (scattered < 0) {
+    return -1;
+  }
+
+  // Every worker gets an equal share of the threads
+  SortOptions part_options = *options;
+  int threads = options->threads > 0
+                    ? options->threads
+                    : (int)std::thread::hardware_concurrency();
+  part_options.threads = std::max(threads / partitions, 1);
+
+  // Anything buffered would otherwise be printed by every worker too
+  std::cout.flush();
+  fflush(stdout);
+
+  std::vector<pid_t> workers;
+  for (int part = 0; part < partitions; part++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("Error starting a worker");
+      break;
+    }
+    if (pid == 0) {
+      int result = sort_partition(filename, fieldNo, part, &part_options);
+      std::cout.flush();
+      fflush(stdout);
+      _exit(result < 0 ? 1 : 0);
+    }
+    workers.push_back(pid);
+  }
+
+  bool failed = (int)workers.size() < partitions;
+  for (pid_t pid : workers) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      failed = true;
+    }
+  }
+  if (failed) {
+    std::cerr << "A partition of " << filename << " could not be sorted"
+              << std::endl;
+    return -1;
+  }
+  return write_manifest(filename, fieldNo, partitions);
+}
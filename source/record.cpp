@@ -1,5 +1,6 @@
 #include "../headers/BF.h"
 #include "../headers/record.h"
+#include "../headers/sort_stats.h"
 #include "../headers/sorted.h"
 #include <assert.h>
 #include <cstring>
@@ -9,7 +10,8 @@
  * Returns true if the first record is less (according to <fieldNo>)
  * than the second record.
  */
-extern bool checkLessThan(Record rec, Record other, int fieldNo) {
+extern bool checkLessThan(const Record &rec, const Record &other, int fieldNo) {
+  sort_counters.comparisons++;
   switch (fieldNo) {
   case 0:
     return rec.id < other.id;
@@ -29,7 +31,7 @@ extern bool checkLessThan(Record rec, Record other, int fieldNo) {
 /*
  * Same as above, but works for a given value instead of another record
  */
-extern bool checkLessThan(Record rec, void *value, int fieldNo) {
+extern bool checkLessThan(const Record &rec, void *value, int fieldNo) {
   switch (fieldNo) {
   case 0:
     return rec.id < *(int *)value;
@@ -48,7 +50,7 @@ extern bool checkLessThan(Record rec, void *value, int fieldNo) {
 /*
  * Same as above, but returns true if the two records are equal
  */
-extern bool checkEqual(Record rec, Record other, int fieldNo) {
+extern bool checkEqual(const Record &rec, const Record &other, int fieldNo) {
   switch (fieldNo) {
   case 0:
     return rec.id == other.id;
@@ -69,7 +71,7 @@ extern bool checkEqual(Record rec, Record other, int fieldNo) {
  * Same as above, but returns true if the record's <fieldNo> is equal to the
  * given value
  */
-extern bool checkEqual(Record rec, void *value, int fieldNo) {
+extern bool checkEqual(const Record &rec, void *value, int fieldNo) {
   switch (fieldNo) {
   case 0:
     return rec.id == *(int *)value;
@@ -86,10 +88,220 @@ extern bool checkEqual(Record rec, void *value, int fieldNo) {
 }
 
 /*
- * Saves the record at offset <offset> of a given block
+ * Builds the key entry of a record. Ids are stored big endian with the sign
+ * bit flipped, so that their byte order matches their numeric order.
+ * Strings are stored up to (not including) their terminator
  */
-extern void save_record(Record record, int offset, void *beg) {
-  memcpy(((Record *)beg + offset), &record, sizeof(record));
+extern KeyEntry make_key_entry(Record rec, int fieldNo, int block, int slot) {
+  KeyEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.block = block;
+  entry.slot = (short)slot;
+
+  const char *str;
+  size_t size;
+  switch (fieldNo) {
+  case 0: {
+    unsigned int id = (unsigned int)rec.id ^ 0x80000000u;
+    entry.key[0] = (unsigned char)(id >> 24);
+    entry.key[1] = (unsigned char)(id >> 16);
+    entry.key[2] = (unsigned char)(id >> 8);
+    entry.key[3] = (unsigned char)id;
+    entry.key_len = 4;
+    return entry;
+  }
+  case 1:
+    str = rec.name;
+    size = sizeof(rec.name);
+    break;
+  case 2:
+    str = rec.surname;
+    size = sizeof(rec.surname);
+    break;
+  default:
+    str = rec.city;
+    size = sizeof(rec.city);
+    break;
+  }
+  entry.key_len = (unsigned char)strnlen(str, size);
+  memcpy(entry.key, str, entry.key_len);
+  return entry;
+}
+
+/*
+ * A group of a single record
+ */
+extern GroupEntry make_group_entry(Record rec, int fieldNo) {
+  KeyEntry entry = make_key_entry(rec, fieldNo, 0, 0);
+  GroupEntry group;
+  memset(&group, 0, sizeof(group));
+  memcpy(group.key, entry.key, entry.key_len);
+  group.key_len = entry.key_len;
+  group.count = 1;
+  group.min_id = rec.id;
+  group.max_id = rec.id;
+  return group;
+}
+
+/*
+ * Adds the records of <other> (a group with the same key) to <group>
+ */
+extern void combine_groups(GroupEntry *group, const GroupEntry &other) {
+  group->count += other.count;
+  if (other.min_id < group->min_id) {
+    group->min_id = other.min_id;
+  }
+  if (other.max_id > group->max_id) {
+    group->max_id = other.max_id;
+  }
+}
+
+/*
+ * Key entries are ordered by their key and then by their location,
+ * which keeps the sort stable
+ */
+extern bool checkLessThan(const KeyEntry &entry, const KeyEntry &other,
+                          int fieldNo) {
+  sort_counters.comparisons++;
+  int len = entry.key_len < other.key_len ? entry.key_len : other.key_len;
+  int cmp = memcmp(entry.key, other.key, (size_t)len);
+  if (cmp != 0) {
+    return cmp < 0;
+  }
+  if (entry.key_len != other.key_len) {
+    return entry.key_len < other.key_len;
+  }
+  if (entry.block != other.block) {
+    return entry.block < other.block;
+  }
+  return entry.slot < other.slot;
+}
+
+/*
+ * Returns true if the two entries have the same key
+ */
+extern bool checkEqual(const KeyEntry &entry, const KeyEntry &other,
+                       int fieldNo) {
+  return entry.key_len == other.key_len &&
+         memcmp(entry.key, other.key, entry.key_len) == 0;
+}
+
+/*
+ * Groups are ordered by their key only (there is one group per key)
+ */
+extern bool checkLessThan(const GroupEntry &group, const GroupEntry &other,
+                          int fieldNo) {
+  sort_counters.comparisons++;
+  int len = group.key_len < other.key_len ? group.key_len : other.key_len;
+  int cmp = memcmp(group.key, other.key, (size_t)len);
+  if (cmp != 0) {
+    return cmp < 0;
+  }
+  return group.key_len < other.key_len;
+}
+
+extern bool checkEqual(const GroupEntry &group, const GroupEntry &other,
+                       int fieldNo) {
+  return group.key_len == other.key_len &&
+         memcmp(group.key, other.key, group.key_len) == 0;
+}
+
+/*
+ * References are ordered by the records they point to
+ */
+extern bool checkLessThan(const RecordRef &ref, const RecordRef &other,
+                          int fieldNo) {
+  return checkLessThan(*ref.record, *other.record, fieldNo);
+}
+
+/*
+ * The page trailer (see sorted.h) is accessed byte by byte,
+ * since it isn't aligned
+ */
+static int get_u16(void *beg, int offset) {
+  unsigned char *bytes = (unsigned char *)beg + offset;
+  return bytes[0] | (bytes[1] << 8);
+}
+
+static void put_u16(void *beg, int offset, int value) {
+  unsigned char *bytes = (unsigned char *)beg + offset;
+  bytes[0] = (unsigned char)(value & 0xff);
+  bytes[1] = (unsigned char)(value >> 8);
+}
+
+#define COUNT_POS (BLOCK_SIZE - 4)
+#define MAGIC_POS (BLOCK_SIZE - 2)
+#define FREE_POS (BLOCK_SIZE - PAGE_TRAILER_SIZE)
+#define SLOT_POS(slot) (FREE_POS - PAGE_SLOT_SIZE * ((slot) + 1))
+
+static bool is_slotted(void *beg) {
+  return get_u16(beg, MAGIC_POS) == SLOTTED_PAGE_MAGIC;
+}
+
+/*
+ * Turns a block into an empty slotted page
+ */
+extern void init_page(void *beg) {
+  put_u16(beg, COUNT_POS, 0);
+  put_u16(beg, MAGIC_POS, SLOTTED_PAGE_MAGIC);
+  put_u16(beg, FREE_POS, 0);
+}
+
+/*
+ * Returns the number of records stored in a given block
+ */
+extern int get_record_count(void *beg) {
+  if (is_slotted(beg)) {
+    return get_u16(beg, COUNT_POS);
+  }
+  return *((int *)beg + FILLED_OFFSET);
+}
+
+static int put_field(unsigned char *out, const char *str, size_t size) {
+  int len = (int)strnlen(str, size);
+  out[0] = (unsigned char)len;
+  memcpy(out + 1, str, (size_t)len);
+  return len + 1;
+}
+
+static int get_field(const unsigned char *in, char *str) {
+  int len = in[0];
+  memcpy(str, in + 1, (size_t)len);
+  return len + 1;
+}
+
+/*
+ * Appends the record to the given block.
+ * Returns false if the block doesn't have enough free space left
+ * (or if it is a non empty block of the previous format)
+ */
+extern bool add_record(Record record, void *beg) {
+  if (!is_slotted(beg)) {
+    if (get_record_count(beg) != 0) {
+      return false;
+    }
+    init_page(beg);
+  }
+
+  unsigned char encoded[sizeof(Record) + 3];
+  int len = 0;
+  memcpy(encoded, &record.id, sizeof(record.id));
+  len += sizeof(record.id);
+  len += put_field(encoded + len, record.name, sizeof(record.name));
+  len += put_field(encoded + len, record.surname, sizeof(record.surname));
+  len += put_field(encoded + len, record.city, sizeof(record.city));
+
+  int count = get_u16(beg, COUNT_POS);
+  int free_offset = get_u16(beg, FREE_POS);
+  if (free_offset + len > SLOT_POS(count)) {
+    return false;
+  }
+
+  memcpy((char *)beg + free_offset, encoded, (size_t)len);
+  put_u16(beg, SLOT_POS(count), free_offset);
+  put_u16(beg, FREE_POS, free_offset + len);
+  put_u16(beg, COUNT_POS, count + 1);
+  return true;
 }
 
 /*
@@ -97,9 +309,27 @@ extern void save_record(Record record, int offset, void *beg) {
  * also checks that the requested offset is not out of bounds
  */
 extern Record get_record(int offset, void *beg) {
-  assert(offset >= 0 && offset < MAX_RECORDS);
-  Record *rec = (Record *)beg + offset;
-  return *rec;
+  assert(offset >= 0 && offset < get_record_count(beg));
+  Record rec;
+  memset(&rec, 0, sizeof(rec));
+
+  if (!is_slotted(beg)) {
+    LegacyRecord *legacy = (LegacyRecord *)beg + offset;
+    rec.id = legacy->id;
+    strncpy(rec.name, legacy->name, sizeof(legacy->name));
+    strncpy(rec.surname, legacy->surname, sizeof(legacy->surname));
+    strncpy(rec.city, legacy->city, sizeof(legacy->city));
+    return rec;
+  }
+
+  const unsigned char *in =
+      (const unsigned char *)beg + get_u16(beg, SLOT_POS(offset));
+  memcpy(&rec.id, in, sizeof(rec.id));
+  in += sizeof(rec.id);
+  in += get_field(in, rec.name);
+  in += get_field(in, rec.surname);
+  get_field(in, rec.city);
+  return rec;
 }
 
 /*
@@ -0,0 +1,468 @@
+#include "../headers/run_codec.h"
+#include "../headers/sort_stats.h"
+#include "../headers/sorted.h"
+#include <algorithm>
+#include <cstring>
+
+/*
+ * Little helpers for the encoding: unsigned LEB128 varints,
+ * zigzag for signed values and length prefixed strings
+ */
+static int put_varint(unsigned char *out, unsigned long value) {
+  int len = 0;
+  while (value >= 0x80) {
+    out[len++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  out[len++] = (unsigned char)value;
+  return len;
+}
+
+static unsigned long get_varint(const unsigned char *in, int *pos) {
+  unsigned long value = 0;
+  int shift = 0;
+  unsigned char byte;
+  do {
+    byte = in[(*pos)++];
+    value |= (unsigned long)(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return value;
+}
+
+static unsigned long zigzag(long value) {
+  return ((unsigned long)value << 1) ^ (unsigned long)(value >> 63);
+}
+
+static long unzigzag(unsigned long value) {
+  return (long)(value >> 1) ^ -(long)(value & 1);
+}
+
+static int put_string(unsigned char *out, const char *str, int len) {
+  out[0] = (unsigned char)len;
+  memcpy(out + 1, str, (size_t)len);
+  return len + 1;
+}
+
+static void get_string(const unsigned char *in, int *pos, char *str) {
+  int len = in[(*pos)++];
+  memcpy(str, in + *pos, (size_t)len);
+  *pos += len;
+}
+
+/*
+ * The string fields of a record, along with their (padded) sizes
+ */
+static char *field_string(Record *record, int fieldNo) {
+  switch (fieldNo) {
+  case 1:
+    return record->name;
+  case 2:
+    return record->surname;
+  default:
+    return record->city;
+  }
+}
+
+static int field_size(int fieldNo) {
+  switch (fieldNo) {
+  case 1:
+    return sizeof(Record::name);
+  case 2:
+    return sizeof(Record::surname);
+  default:
+    return sizeof(Record::city);
+  }
+}
+
+static int field_length(Record *record, int fieldNo) {
+  return (int)strnlen(field_string(record, fieldNo), (size_t)field_size(fieldNo));
+}
+
+/*
+ * Returns the slot of <city> in the writer's dictionary table: the one
+ * that holds its code, or the empty one it would go into (the table is
+ * never more than half full)
+ */
+static int dict_slot(const RunWriter *writer, const char *city, int len) {
+  unsigned int hash = 2166136261u;
+  for (int i = 0; i < len; i++) {
+    hash = (hash ^ (unsigned char)city[i]) * 16777619u;
+  }
+  int slot = (int)(hash & (RUN_DICT_SLOTS - 1));
+  while (true) {
+    int code = writer->dict_slots[slot];
+    if (code < 0 ||
+        (writer->dict_lengths[code] == len &&
+         memcmp(&writer->dict_cities[(size_t)code * RUN_DICT_CITY], city,
+                (size_t)len) == 0)) {
+      return slot;
+    }
+    slot = (slot + 1) & (RUN_DICT_SLOTS - 1);
+  }
+}
+
+static void dict_add(RunWriter *writer, const char *city, int len) {
+  int code = writer->dict_size++;
+  memcpy(&writer->dict_cities[(size_t)code * RUN_DICT_CITY], city,
+         (size_t)len);
+  writer->dict_lengths[code] = (unsigned char)len;
+  writer->dict_slots[dict_slot(writer, city, len)] = (short)code;
+}
+
+/*
+ * Encodes <record> into <out> (against the writer's current state)
+ * and returns the encoded length. If the city has to be added to the
+ * dictionary, <new_city> is set (the caller adds it once the record
+ * has actually been placed in the block)
+ */
+static int encode_record(RunWriter *writer, Record *record,
+                         unsigned char *out, bool *new_city) {
+  int fieldNo = writer->fieldNo;
+  int len = 0;
+  *new_city = false;
+
+  // The front coded sort key
+  if (fieldNo == 0) {
+    len += put_varint(out, zigzag((long)record->id - (long)writer->prev.id));
+  } else {
+    char *key = field_string(record, fieldNo);
+    char *prev_key = field_string(&writer->prev, fieldNo);
+    int key_len = field_length(record, fieldNo);
+    int prev_len = field_length(&writer->prev, fieldNo);
+    int shared = 0;
+    while (shared < key_len && shared < prev_len &&
+           key[shared] == prev_key[shared]) {
+      shared++;
+    }
+    out[len++] = (unsigned char)shared;
+    len += put_string(out + len, key + shared, key_len - shared);
+  }
+
+  // The rest of the fields, without their padding
+  if (fieldNo != 0) {
+    len += put_varint(out + len, zigzag(record->id));
+  }
+  if (fieldNo != 1) {
+    len += put_string(out + len, record->name, field_length(record, 1));
+  }
+  if (fieldNo != 2) {
+    len += put_string(out + len, record->surname, field_length(record, 2));
+  }
+  if (fieldNo != 3) {
+    int city_len = field_length(record, 3);
+    int code = writer->dict_slots[dict_slot(writer, record->city, city_len)];
+    if (code >= 0) {
+      len += put_varint(out + len, (unsigned long)code + 1);
+    } else {
+      out[len++] = 0;
+      len += put_string(out + len, record->city, city_len);
+      *new_city = writer->dict_size < RUN_DICT_SIZE;
+    }
+  }
+  return len;
+}
+
+/*
+ * Writes the writer's current block at the end of the run
+ */
+static void flush_run_block(RunWriter *writer) {
+  if (writer->count == 0) {
+    return;
+  }
+  writer->block[0] = (unsigned char)(writer->count & 0xff);
+  writer->block[1] = (unsigned char)(writer->count >> 8);
+  writer->block[2] = writer->dict_reset ? RUN_BLOCK_DICT_RESET : 0;
+
+  spill_append_block(writer->spill, writer->run, writer->block);
+  writer->blocks++;
+
+  // Front coding starts over in every block
+  memset(writer->block, 0, BLOCK_SIZE);
+  memset(&writer->prev, 0, sizeof(writer->prev));
+  memset(&writer->prev_key, 0, sizeof(writer->prev_key));
+  writer->used = RUN_BLOCK_HEADER;
+  writer->count = 0;
+  writer->dict_reset = false;
+}
+
+extern void run_writer_open(RunWriter *writer, SpillFile *spill, int run,
+                            int fieldNo) {
+  writer->spill = spill;
+  writer->run = run;
+  writer->fieldNo = fieldNo;
+  memset(writer->block, 0, BLOCK_SIZE);
+  memset(&writer->prev, 0, sizeof(writer->prev));
+  memset(&writer->prev_key, 0, sizeof(writer->prev_key));
+  writer->used = RUN_BLOCK_HEADER;
+  writer->count = 0;
+  writer->dict_reset = true;
+  if (writer->dict_slots.empty()) {
+    writer->dict_cities.resize((size_t)RUN_DICT_SIZE * RUN_DICT_CITY);
+    writer->dict_lengths.resize(RUN_DICT_SIZE);
+    writer->dict_slots.resize(RUN_DICT_SLOTS);
+  }
+  std::fill(writer->dict_slots.begin(), writer->dict_slots.end(), -1);
+  writer->dict_size = 0;
+  writer->records = 0;
+  writer->blocks = 0;
+}
+
+extern void run_write(RunWriter *writer, const Record &record) {
+  sort_counters.records_moved++;
+  Record rec = record;
+  unsigned char encoded[sizeof(Record) * 2];
+  bool new_city;
+  int len = encode_record(writer, &rec, encoded, &new_city);
+
+  // If the record doesn't fit, it starts the next block
+  // (and is encoded again, since the front coding starts over)
+  if (writer->used + len > BLOCK_SIZE || writer->count == RUN_MAX_RECORDS) {
+    flush_run_block(writer);
+    len = encode_record(writer, &rec, encoded, &new_city);
+  }
+
+  memcpy(writer->block + writer->used, encoded, (size_t)len);
+  writer->used += len;
+  writer->count++;
+  writer->records++;
+  writer->prev = rec;
+  if (new_city) {
+    dict_add(writer, rec.city, field_length(&rec, 3));
+  }
+}
+
+/*
+ * Key entries: the front coded key, then the block and slot
+ */
+static int encode_entry(RunWriter *writer, const KeyEntry &entry,
+                        unsigned char *out) {
+  const KeyEntry &prev = writer->prev_key;
+  int shared = 0;
+  while (shared < entry.key_len && shared < prev.key_len &&
+         entry.key[shared] == prev.key[shared]) {
+    shared++;
+  }
+  int len = 0;
+  out[len++] = (unsigned char)shared;
+  len += put_string(out + len, (const char *)entry.key + shared,
+                    entry.key_len - shared);
+  len += put_varint(out + len, (unsigned long)entry.block);
+  len += put_varint(out + len, (unsigned long)entry.slot);
+  return len;
+}
+
+extern void run_write(RunWriter *writer, const KeyEntry &entry) {
+  sort_counters.records_moved++;
+  unsigned char encoded[sizeof(KeyEntry) * 2];
+  int len = encode_entry(writer, entry, encoded);
+
+  if (writer->used + len > BLOCK_SIZE || writer->count == RUN_MAX_RECORDS) {
+    flush_run_block(writer);
+    len = encode_entry(writer, entry, encoded);
+  }
+
+  memcpy(writer->block + writer->used, encoded, (size_t)len);
+  writer->used += len;
+  writer->count++;
+  writer->records++;
+  writer->prev_key = entry;
+}
+
+/*
+ * Groups: the front coded key (against the previous group's key, which is
+ * kept in prev_key), then the count, the smallest id and the id range
+ */
+static int encode_group(RunWriter *writer, const GroupEntry &group,
+                        unsigned char *out) {
+  const KeyEntry &prev = writer->prev_key;
+  int shared = 0;
+  while (shared < group.key_len && shared < prev.key_len &&
+         group.key[shared] == prev.key[shared]) {
+    shared++;
+  }
+  int len = 0;
+  out[len++] = (unsigned char)shared;
+  len += put_string(out + len, (const char *)group.key + shared,
+                    group.key_len - shared);
+  len += put_varint(out + len, (unsigned long)group.count);
+  len += put_varint(out + len, zigzag(group.min_id));
+  len += put_varint(out + len,
+                    (unsigned long)((long)group.max_id - group.min_id));
+  return len;
+}
+
+extern void run_write(RunWriter *writer, const GroupEntry &group) {
+  sort_counters.records_moved++;
+  unsigned char encoded[sizeof(GroupEntry) * 2];
+  int len = encode_group(writer, group, encoded);
+
+  if (writer->used + len > BLOCK_SIZE || writer->count == RUN_MAX_RECORDS) {
+    flush_run_block(writer);
+    len = encode_group(writer, group, encoded);
+  }
+
+  memcpy(writer->block + writer->used, encoded, (size_t)len);
+  writer->used += len;
+  writer->count++;
+  writer->records++;
+  memcpy(writer->prev_key.key, group.key, group.key_len);
+  writer->prev_key.key_len = group.key_len;
+}
+
+extern void run_writer_close(RunWriter *writer) {
+  flush_run_block(writer);
+  spill_flush_run(writer->spill, writer->run);
+}
+
+extern void run_reader_open(RunReader *reader, SpillFile *spill, int run,
+                            int fieldNo) {
+  reader->spill = spill;
+  reader->run = run;
+  reader->fieldNo = fieldNo;
+  reader->num_blocks = spill_run_blocks(spill, run);
+  reader->next_block = 0;
+  reader->pos = 0;
+  reader->remaining = 0;
+  if (reader->dict_cities.empty()) {
+    reader->dict_cities.resize((size_t)RUN_DICT_SIZE * RUN_DICT_CITY);
+    reader->dict_lengths.resize(RUN_DICT_SIZE);
+  }
+  reader->dict_size = 0;
+}
+
+/*
+ * Makes sure that the reader's current block has entries left,
+ * loading the next block of the run (or of the next run of its chain)
+ * if needed.
+ * Returns false once the whole run has been read
+ */
+static bool next_entry(RunReader *reader) {
+  while (reader->remaining == 0) {
+    while (reader->next_block == reader->num_blocks) {
+      int next_run = spill_next_run(reader->spill, reader->run);
+      if (next_run < 0) {
+        return false;
+      }
+      reader->run = next_run;
+      reader->num_blocks = spill_run_blocks(reader->spill, next_run);
+      reader->next_block = 0;
+    }
+    spill_read_block(reader->spill, reader->run, reader->next_block++,
+                     reader->block);
+    reader->remaining = reader->block[0] | (reader->block[1] << 8);
+    if (reader->block[2] & RUN_BLOCK_DICT_RESET) {
+      reader->dict_size = 0;
+    }
+    reader->pos = RUN_BLOCK_HEADER;
+    memset(&reader->prev, 0, sizeof(reader->prev));
+    memset(&reader->prev_key, 0, sizeof(reader->prev_key));
+  }
+  return true;
+}
+
+/*
+ * Decodes the next record of the run into <record>.
+ * Returns false once the whole run has been read
+ */
+extern bool run_read(RunReader *reader, Record *record) {
+  if (!next_entry(reader)) {
+    return false;
+  }
+
+  int fieldNo = reader->fieldNo;
+  const unsigned char *in = reader->block;
+  Record rec;
+  memset(&rec, 0, sizeof(rec));
+
+  if (fieldNo == 0) {
+    rec.id = (int)((long)reader->prev.id + unzigzag(get_varint(in, &reader->pos)));
+  } else {
+    int shared = in[reader->pos++];
+    char *key = field_string(&rec, fieldNo);
+    memcpy(key, field_string(&reader->prev, fieldNo), (size_t)shared);
+    get_string(in, &reader->pos, key + shared);
+  }
+
+  if (fieldNo != 0) {
+    rec.id = (int)unzigzag(get_varint(in, &reader->pos));
+  }
+  if (fieldNo != 1) {
+    get_string(in, &reader->pos, rec.name);
+  }
+  if (fieldNo != 2) {
+    get_string(in, &reader->pos, rec.surname);
+  }
+  if (fieldNo != 3) {
+    unsigned long code = get_varint(in, &reader->pos);
+    if (code == 0) {
+      get_string(in, &reader->pos, rec.city);
+      if (reader->dict_size < RUN_DICT_SIZE) {
+        int len = field_length(&rec, 3);
+        memcpy(&reader->dict_cities[(size_t)reader->dict_size * RUN_DICT_CITY],
+               rec.city, (size_t)len);
+        reader->dict_lengths[reader->dict_size++] = (unsigned char)len;
+      }
+    } else {
+      memcpy(rec.city, &reader->dict_cities[(code - 1) * RUN_DICT_CITY],
+             reader->dict_lengths[code - 1]);
+    }
+  }
+
+  reader->remaining--;
+  reader->prev = rec;
+  *record = rec;
+  return true;
+}
+
+/*
+ * Same as above, for runs of key entries
+ */
+extern bool run_read(RunReader *reader, KeyEntry *entry) {
+  if (!next_entry(reader)) {
+    return false;
+  }
+
+  const unsigned char *in = reader->block;
+  KeyEntry decoded;
+  memset(&decoded, 0, sizeof(decoded));
+  int shared = in[reader->pos++];
+  memcpy(decoded.key, reader->prev_key.key, (size_t)shared);
+  int suffix = in[reader->pos];
+  get_string(in, &reader->pos, (char *)decoded.key + shared);
+  decoded.key_len = (unsigned char)(shared + suffix);
+  decoded.block = (int)get_varint(in, &reader->pos);
+  decoded.slot = (short)get_varint(in, &reader->pos);
+
+  reader->remaining--;
+  reader->prev_key = decoded;
+  *entry = decoded;
+  return true;
+}
+
+/*
+ * Same as above, for runs of groups
+ */
+extern bool run_read(RunReader *reader, GroupEntry *group) {
+  if (!next_entry(reader)) {
+    return false;
+  }
+
+  const unsigned char *in = reader->block;
+  GroupEntry decoded;
+  memset(&decoded, 0, sizeof(decoded));
+  int shared = in[reader->pos++];
+  memcpy(decoded.key, reader->prev_key.key, (size_t)shared);
+  int suffix = in[reader->pos];
+  get_string(in, &reader->pos, (char *)decoded.key + shared);
+  decoded.key_len = (unsigned char)(shared + suffix);
+  decoded.count = (int)get_varint(in, &reader->pos);
+  decoded.min_id = (int)unzigzag(get_varint(in, &reader->pos));
+  decoded.max_id = (int)((long)decoded.min_id + get_varint(in, &reader->pos));
+
+  reader->remaining--;
+  memcpy(reader->prev_key.key, decoded.key, decoded.key_len);
+  reader->prev_key.key_len = decoded.key_len;
+  *group = decoded;
+  return true;
+}
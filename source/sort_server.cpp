@@ -0,0 +1,753 @@
+#include "../headers/buffer_pool.h"
+#include "../headers/sorted.h"
+#include "../headers/u_functions.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Sort server:
+ *   sort_server [-s socket] [-w workers] [-m memory MB] [-j job dir]
+ *
+ * A long running process that takes sort and lookup jobs over a Unix
+ * socket, so that concurrent sorts share one memory budget instead of
+ * each one sizing itself for the whole machine.
+ *
+ * Every job runs in a worker process of its own (as the partitions of
+ * Sorted_ParallelSortFile() do, since neither the BF layer nor the sort
+ * statistics are shared between threads), and at most <workers> of them
+ * run at once. A job is admitted only if its memory (the sort's arena, see
+ * Sorted_SortMemory(), plus the worker's buffer pool) fits in what is left
+ * of the budget. Jobs start in the order they arrived: a job waiting for
+ * memory holds back the jobs after it, so that a large sort is never
+ * starved, while a job waiting for another job of the same file to finish
+ * does not. A job that needs more than the whole budget is refused.
+ *
+ * Workers report the progress of their sort through a pipe, and their own
+ * output goes to <job dir>/job_<id>.out.
+ *
+ * The protocol is one command per line (file names can't hold spaces):
+ *   sort <file> <field> [option=value ...]      -> queued <id>
+ *     mode=records|keys  memory=<blocks>  fan_in=<runs>  limit=<records>
+ *     aggregate=none|distinct|group  gather=<blocks>  direct=0|1
+ *     temp=<dir>  checkpoint=<dir>
+ *   lookup <file> <field> <value>               -> queued <id>
+ *   status [<id>]   -> one line per job, then end:
+ *     job <id> <kind> <state> <file> <field> <phase> <done>/<total>
+ *         eta <seconds> memory <bytes>
+ *   wait <id>       -> done <id> ok|failed|cancelled <output file>
+ *                      (once the job has finished)
+ *   cancel <id>     -> cancelled <id> (a running job is killed)
+ *   server          -> server workers <running>/<workers>
+ *                          memory <used>/<budget> queued <jobs>
+ *   shutdown        -> bye (queued jobs are cancelled, running ones finish)
+ * and every command may be answered with: error <message>
+ */
+#define SERVER_DEFAULT_SOCKET "/tmp/external_sort.sock"
+#define SERVER_DEFAULT_WORKERS 4
+#define SERVER_DEFAULT_MEMORY_MB 256
+#define SERVER_PROGRESS_INTERVAL 0.5
+// Finished jobs kept for status and wait
+#define SERVER_FINISHED_JOBS 1024
+
+#define JOB_SORT 0
+#define JOB_LOOKUP 1
+
+#define JOB_QUEUED 0
+#define JOB_RUNNING 1
+#define JOB_DONE 2
+#define JOB_FAILED 3
+#define JOB_CANCELLED 4
+
+static const char *job_kinds[] = {"sort", "lookup"};
+static const char *job_states[] = {"queued", "running", "ok", "failed",
+                                   "cancelled"};
+
+/*
+ * What a worker writes to its pipe, at most once every
+ * SERVER_PROGRESS_INTERVAL seconds (small enough to be written atomically)
+ */
+struct ProgressMessage {
+  char phase[SORT_PHASE_NAME_SIZE];
+  long blocks_done;
+  long blocks_total;
+  double eta_seconds;
+};
+
+struct Job {
+  int id;
+  int kind;
+  std::string file;
+  int fieldNo;
+  SortOptions options;
+  // Kept here, since <options> only points to them
+  std::string temp_dir;
+  std::string checkpoint_dir;
+  std::string value;
+  size_t memory;
+  int state;
+  bool cancel;
+  pid_t pid;
+  int progress_fd;
+  ProgressMessage progress;
+  std::string output;
+};
+
+struct Client {
+  int fd;
+  std::string input;
+};
+
+struct Server {
+  std::string socket_path;
+  std::string job_dir;
+  int workers;
+  size_t budget;
+  int listen_fd;
+  std::map<int, Client> clients;
+  std::map<int, Job> jobs;
+  // Job ids, in order of arrival
+  std::vector<int> queue;
+  int running;
+  size_t memory_used;
+  int next_id;
+  // (client, job) pairs, answered when the job finishes
+  std::vector<std::pair<int, int>> waiters;
+  bool stopping;
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int) { stop_requested = 1; }
+
+static void send_line(int fd, const std::string &line) {
+  std::string data = line + "\n";
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+    sent += (size_t)n;
+  }
+}
+
+static bool parse_long(const std::string &text, long *value) {
+  char *end;
+  errno = 0;
+  *value = strtol(text.c_str(), &end, 10);
+  return !text.empty() && *end == 0 && errno == 0;
+}
+
+/*
+ * Parses the option=value words of a sort command into <job>.
+ * Returns an error message, or an empty string
+ */
+static std::string parse_sort_options(const std::vector<std::string> &words,
+                                      Job *job) {
+  SortOptions &options = job->options;
+  for (size_t i = 3; i < words.size(); i++) {
+    size_t eq = words[i].find('=');
+    if (eq == std::string::npos) {
+      return "expected option=value: " + words[i];
+    }
+    std::string name = words[i].substr(0, eq);
+    std::string text = words[i].substr(eq + 1);
+    long value = 0;
+    bool numeric = parse_long(text, &value);
+    if (name == "mode" && (text == "records" || text == "keys")) {
+      options.mode = text == "keys" ? SORT_MODE_KEYS : SORT_MODE_RECORDS;
+    } else if (name == "aggregate" &&
+               (text == "none" || text == "distinct" || text == "group")) {
+      options.aggregate = text == "distinct" ? SORT_AGGREGATE_DISTINCT
+                          : text == "group"  ? SORT_AGGREGATE_GROUP_BY
+                                             : SORT_AGGREGATE_NONE;
+    } else if (name == "memory" && numeric && value > 0) {
+      options.memory_blocks = value;
+    } else if (name == "fan_in" && numeric && value > 1) {
+      options.max_open_runs = (int)value;
+    } else if (name == "limit" && numeric && value >= 0) {
+      options.limit = value;
+    } else if (name == "gather" && numeric && value > 0) {
+      options.gather_blocks = (int)value;
+    } else if (name == "direct" && numeric) {
+      options.direct_io = value != 0;
+    } else if (name == "temp" && !text.empty()) {
+      job->temp_dir = text;
+    } else if (name == "checkpoint" && !text.empty()) {
+      job->checkpoint_dir = text;
+    } else {
+      return "bad option: " + words[i];
+    }
+  }
+  return "";
+}
+
+/*
+ * Closes the descriptors a worker must not keep: otherwise the clients
+ * and the other workers' pipes would stay open as long as it runs
+ */
+static void close_server_fds(Server *server) {
+  close(server->listen_fd);
+  for (auto &entry : server->clients) {
+    close(entry.first);
+  }
+  for (auto &entry : server->jobs) {
+    if (entry.second.state == JOB_RUNNING) {
+      close(entry.second.progress_fd);
+    }
+  }
+}
+
+static void report_progress(const SortProgress *progress, void *arg) {
+  ProgressMessage message;
+  memset(&message, 0, sizeof(message));
+  strncpy(message.phase, progress->phase, SORT_PHASE_NAME_SIZE - 1);
+  message.blocks_done = progress->blocks_done;
+  message.blocks_total = progress->blocks_total;
+  message.eta_seconds = progress->eta_seconds;
+  // The pipe is non-blocking: a busy server just misses an update
+  if (write(*(int *)arg, &message, sizeof(message)) < 0) {
+    return;
+  }
+}
+
+/*
+ * The work of a worker process. Returns 0 on success, -1 otherwise
+ */
+static int run_job(Job *job, int progress_fd) {
+  BF_Init();
+  Pool_Init(POOL_DEFAULT_CAPACITY, POOL_DEFAULT_SHARDS);
+  if (job->kind == JOB_LOOKUP) {
+    int file_desc = Sorted_OpenFile(job->file.c_str());
+    if (file_desc < 0) {
+      return -1;
+    }
+    Record key;
+    memset(&key, 0, sizeof(key));
+    void *value = &key.id;
+    if (job->fieldNo == 0) {
+      key.id = atoi(job->value.c_str());
+    } else {
+      char *field = job->fieldNo == 1   ? key.name
+                    : job->fieldNo == 2 ? key.surname
+                                        : key.city;
+      size_t size = job->fieldNo == 1   ? sizeof(key.name)
+                    : job->fieldNo == 2 ? sizeof(key.surname)
+                                        : sizeof(key.city);
+      strncpy(field, job->value.c_str(), size - 1);
+      value = field;
+    }
+    Sorted_GetAllEntries(file_desc, &job->fieldNo, value);
+    return Sorted_CloseFile(file_desc) < 0 ? -1 : 0;
+  }
+
+  SortOptions options = job->options;
+  options.temp_dir = job->temp_dir.empty() ? NULL : job->temp_dir.c_str();
+  options.checkpoint_dir =
+      job->checkpoint_dir.empty() ? NULL : job->checkpoint_dir.c_str();
+  options.progress = report_progress;
+  options.progress_arg = &progress_fd;
+  options.progress_interval = SERVER_PROGRESS_INTERVAL;
+  return Sorted_SortFileWithOptions(job->file.c_str(), job->fieldNo, &options);
+}
+
+/*
+ * Starts a worker for <job>. Returns -1 if it couldn't be started
+ */
+static int start_job(Server *server, Job *job) {
+  int pipe_fds[2];
+  if (pipe(pipe_fds) < 0) {
+    perror("Error creating a progress pipe");
+    return -1;
+  }
+  std::cout.flush();
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("Error starting a worker");
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    close_server_fds(server);
+    close(pipe_fds[0]);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    fcntl(pipe_fds[1], F_SETFL, O_NONBLOCK);
+    // The library's own output goes to the job's output file
+    int out = open(job->output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out >= 0) {
+      dup2(out, STDOUT_FILENO);
+      dup2(out, STDERR_FILENO);
+      close(out);
+    }
+    int result = run_job(job, pipe_fds[1]);
+    std::cout.flush();
+    fflush(stdout);
+    _exit(result < 0 ? 1 : 0);
+  }
+  close(pipe_fds[1]);
+  job->pid = pid;
+  job->progress_fd = pipe_fds[0];
+  job->state = JOB_RUNNING;
+  server->running++;
+  server->memory_used += job->memory;
+  std::cout << "Job " << job->id << " started (" << job_kinds[job->kind] << " "
+            << job->file << ")" << std::endl;
+  return 0;
+}
+
+static bool file_busy(const Server *server, const std::string &file) {
+  for (const auto &entry : server->jobs) {
+    if (entry.second.state == JOB_RUNNING && entry.second.file == file) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static std::string job_result(const Job &job) {
+  return "done " + std::to_string(job.id) + " " + job_states[job.state] + " " +
+         job.output;
+}
+
+/*
+ * Answers the clients waiting for <job>, and forgets the oldest
+ * finished jobs
+ */
+static void job_finished(Server *server, const Job &job) {
+  std::cout << "Job " << job.id << " " << job_states[job.state] << std::endl;
+  for (size_t i = 0; i < server->waiters.size();) {
+    if (server->waiters[i].second == job.id) {
+      send_line(server->waiters[i].first, job_result(job));
+      server->waiters.erase(server->waiters.begin() + (long)i);
+    } else {
+      i++;
+    }
+  }
+
+  int finished = 0;
+  for (const auto &entry : server->jobs) {
+    finished += entry.second.state >= JOB_DONE;
+  }
+  for (auto it = server->jobs.begin();
+       it != server->jobs.end() && finished > SERVER_FINISHED_JOBS;) {
+    bool waited = false;
+    for (const auto &waiter : server->waiters) {
+      waited = waited || waiter.second == it->first;
+    }
+    if (it->second.state >= JOB_DONE && it->first != job.id && !waited) {
+      it = server->jobs.erase(it);
+      finished--;
+    } else {
+      ++it;
+    }
+  }
+}
+
+/*
+ * Admits the queued jobs that fit (see the top of the file)
+ */
+static void schedule(Server *server) {
+  for (size_t i = 0; i < server->queue.size();) {
+    if (server->running >= server->workers) {
+      return;
+    }
+    Job &job = server->jobs[server->queue[i]];
+    if (file_busy(server, job.file)) {
+      i++;
+      continue;
+    }
+    if (server->memory_used + job.memory > server->budget) {
+      return;
+    }
+    server->queue.erase(server->queue.begin() + (long)i);
+    if (start_job(server, &job) < 0) {
+      job.state = JOB_FAILED;
+      job_finished(server, job);
+    }
+  }
+}
+
+/*
+ * Reads the progress of a running job. Once the worker is gone,
+ * it is reaped and its memory is given back
+ */
+static void read_progress(Server *server, Job *job) {
+  ProgressMessage message;
+  ssize_t n = read(job->progress_fd, &message, sizeof(message));
+  if (n == (ssize_t)sizeof(message)) {
+    job->progress = message;
+    return;
+  }
+  if (n < 0 && errno == EINTR) {
+    return;
+  }
+  close(job->progress_fd);
+  int status;
+  bool ok = waitpid(job->pid, &status, 0) == job->pid && WIFEXITED(status) &&
+            WEXITSTATUS(status) == 0;
+  job->state = job->cancel ? JOB_CANCELLED : ok ? JOB_DONE : JOB_FAILED;
+  server->running--;
+  server->memory_used -= job->memory;
+  job_finished(server, *job);
+}
+
+static std::string status_line(const Job &job) {
+  char line[512];
+  const ProgressMessage &progress = job.progress;
+  snprintf(line, sizeof(line),
+           "job %d %s %s %s %d %s %ld/%ld eta %.1f memory %zu", job.id,
+           job_kinds[job.kind], job_states[job.state], job.file.c_str(),
+           job.fieldNo, progress.phase[0] ? progress.phase : "-",
+           progress.blocks_done, progress.blocks_total, progress.eta_seconds,
+           job.memory);
+  return line;
+}
+
+/*
+ * Queues a sort or lookup job. Returns the reply to the client
+ */
+static std::string submit(Server *server, const std::vector<std::string> &words,
+                          int kind) {
+  long fieldNo;
+  if (words.size() < 3 || !parse_long(words[2], &fieldNo) || fieldNo < 0 ||
+      fieldNo > 3) {
+    return "error usage: " + words[0] + " <file> <field 0-3> ...";
+  }
+  if (server->stopping) {
+    return "error the server is shutting down";
+  }
+  Job job = Job();
+  job.kind = kind;
+  job.file = words[1];
+  job.fieldNo = (int)fieldNo;
+  job.pid = -1;
+  job.progress_fd = -1;
+  size_t pool_bytes = (size_t)POOL_DEFAULT_CAPACITY * BLOCK_SIZE;
+  if (kind == JOB_LOOKUP) {
+    if (words.size() != 4) {
+      return "error usage: lookup <file> <field 0-3> <value>";
+    }
+    job.value = words[3];
+    job.memory = pool_bytes;
+  } else {
+    std::string error = parse_sort_options(words, &job);
+    if (!error.empty()) {
+      return "error " + error;
+    }
+    job.memory = Sorted_SortMemory(&job.options) + pool_bytes;
+  }
+  if (job.memory > server->budget) {
+    return "error the job needs " + std::to_string(job.memory) +
+           " bytes, the budget is " + std::to_string(server->budget);
+  }
+  job.id = server->next_id++;
+  job.output = server->job_dir + "/job_" + std::to_string(job.id) + ".out";
+  job.state = JOB_QUEUED;
+  server->jobs[job.id] = job;
+  server->queue.push_back(job.id);
+  schedule(server);
+  return "queued " + std::to_string(job.id);
+}
+
+static Job *find_job(Server *server, const std::vector<std::string> &words) {
+  long id;
+  if (words.size() != 2 || !parse_long(words[1], &id)) {
+    return NULL;
+  }
+  auto it = server->jobs.find((int)id);
+  return it == server->jobs.end() ? NULL : &it->second;
+}
+
+static void cancel_job(Server *server, Job *job) {
+  if (job->state == JOB_QUEUED) {
+    for (size_t i = 0; i < server->queue.size(); i++) {
+      if (server->queue[i] == job->id) {
+        server->queue.erase(server->queue.begin() + (long)i);
+        break;
+      }
+    }
+    job->state = JOB_CANCELLED;
+    job_finished(server, *job);
+  } else if (job->state == JOB_RUNNING) {
+    // Reaped (and answered) once its pipe is closed
+    job->cancel = true;
+    kill(job->pid, SIGTERM);
+  }
+}
+
+static void handle_command(Server *server, int fd, const std::string &line) {
+  std::istringstream stream(line);
+  std::vector<std::string> words;
+  std::string word;
+  while (stream >> word) {
+    words.push_back(word);
+  }
+  if (words.empty()) {
+    return;
+  }
+  const std::string &command = words[0];
+  if (command == "sort") {
+    send_line(fd, submit(server, words, JOB_SORT));
+  } else if (command == "lookup") {
+    send_line(fd, submit(server, words, JOB_LOOKUP));
+  } else if (command == "status") {
+    if (words.size() > 1) {
+      Job *job = find_job(server, words);
+      if (job == NULL) {
+        send_line(fd, "error unknown job");
+        return;
+      }
+      send_line(fd, status_line(*job));
+    } else {
+      for (const auto &entry : server->jobs) {
+        send_line(fd, status_line(entry.second));
+      }
+    }
+    send_line(fd, "end");
+  } else if (command == "wait") {
+    Job *job = find_job(server, words);
+    if (job == NULL) {
+      send_line(fd, "error unknown job");
+    } else if (job->state >= JOB_DONE) {
+      send_line(fd, job_result(*job));
+    } else {
+      server->waiters.push_back({fd, job->id});
+    }
+  } else if (command == "cancel") {
+    Job *job = find_job(server, words);
+    if (job == NULL) {
+      send_line(fd, "error unknown job");
+      return;
+    }
+    if (job->state >= JOB_DONE) {
+      send_line(fd, "error job " + std::to_string(job->id) + " has finished");
+      return;
+    }
+    cancel_job(server, job);
+    send_line(fd, "cancelled " + std::to_string(job->id));
+  } else if (command == "server") {
+    std::ostringstream reply;
+    reply << "server workers " << server->running << "/" << server->workers
+          << " memory " << server->memory_used << "/" << server->budget
+          << " queued " << server->queue.size();
+    send_line(fd, reply.str());
+  } else if (command == "shutdown") {
+    stop_requested = 1;
+    send_line(fd, "bye");
+  } else {
+    send_line(fd, "error unknown command: " + command);
+  }
+}
+
+static void drop_client(Server *server, int fd) {
+  for (size_t i = 0; i < server->waiters.size();) {
+    if (server->waiters[i].first == fd) {
+      server->waiters.erase(server->waiters.begin() + (long)i);
+    } else {
+      i++;
+    }
+  }
+  close(fd);
+  server->clients.erase(fd);
+}
+
+static void read_client(Server *server, int fd) {
+  char data[4096];
+  ssize_t n = read(fd, data, sizeof(data));
+  if (n < 0 && errno == EINTR) {
+    return;
+  }
+  if (n <= 0) {
+    drop_client(server, fd);
+    return;
+  }
+  server->clients[fd].input.append(data, (size_t)n);
+  size_t end;
+  while (server->clients.count(fd) &&
+         (end = server->clients[fd].input.find('\n')) != std::string::npos) {
+    std::string line = server->clients[fd].input.substr(0, end);
+    server->clients[fd].input.erase(0, end + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    handle_command(server, fd, line);
+  }
+}
+
+/*
+ * Stops taking jobs: the queued ones are cancelled, the running ones
+ * are left to finish
+ */
+static void begin_stop(Server *server) {
+  server->stopping = true;
+  close(server->listen_fd);
+  server->listen_fd = -1;
+  unlink(server->socket_path.c_str());
+  while (!server->queue.empty()) {
+    cancel_job(server, &server->jobs[server->queue.front()]);
+  }
+  std::cout << "Shutting down after " << server->running << " running jobs"
+            << std::endl;
+}
+
+static int open_socket(Server *server) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (server->socket_path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path too long: " << server->socket_path << std::endl;
+    return -1;
+  }
+  strcpy(address.sun_path, server->socket_path.c_str());
+  server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server->listen_fd < 0) {
+    perror("Error creating the socket");
+    return -1;
+  }
+  // A server that didn't shut down cleanly leaves its socket behind
+  unlink(server->socket_path.c_str());
+  if (bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) <
+          0 ||
+      listen(server->listen_fd, SOMAXCONN) < 0) {
+    perror("Error binding the socket");
+    close(server->listen_fd);
+    return -1;
+  }
+  return 0;
+}
+
+static void serve(Server *server) {
+  std::vector<struct pollfd> fds;
+  while (!server->stopping || server->running > 0) {
+    if (stop_requested && !server->stopping) {
+      begin_stop(server);
+      continue;
+    }
+    fds.clear();
+    if (server->listen_fd >= 0) {
+      fds.push_back({server->listen_fd, POLLIN, 0});
+    }
+    for (const auto &entry : server->clients) {
+      fds.push_back({entry.first, POLLIN, 0});
+    }
+    std::vector<int> running;
+    for (const auto &entry : server->jobs) {
+      if (entry.second.state == JOB_RUNNING) {
+        fds.push_back({entry.second.progress_fd, POLLIN, 0});
+        running.push_back(entry.first);
+      }
+    }
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("Error polling");
+      return;
+    }
+
+    size_t i = 0;
+    if (server->listen_fd >= 0) {
+      if (fds[i].revents & POLLIN) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd >= 0) {
+          server->clients[fd] = Client{fd, ""};
+        }
+      }
+      i++;
+    }
+    std::vector<int> ready;
+    for (; i < fds.size() - running.size(); i++) {
+      if (fds[i].revents) {
+        ready.push_back(fds[i].fd);
+      }
+    }
+    for (int fd : ready) {
+      read_client(server, fd);
+    }
+    for (size_t j = 0; j < running.size(); j++, i++) {
+      if (fds[i].revents) {
+        read_progress(server, &server->jobs[running[j]]);
+      }
+    }
+    schedule(server);
+  }
+}
+
+int main(int argc, char **argv) {
+  Server server;
+  server.socket_path = SERVER_DEFAULT_SOCKET;
+  server.job_dir = "server_jobs";
+  server.workers = SERVER_DEFAULT_WORKERS;
+  long memory_mb = SERVER_DEFAULT_MEMORY_MB;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:w:m:j:")) != -1) {
+    switch (opt) {
+    case 's':
+      server.socket_path = optarg;
+      break;
+    case 'w':
+      server.workers = atoi(optarg);
+      break;
+    case 'm':
+      memory_mb = atol(optarg);
+      break;
+    case 'j':
+      server.job_dir = optarg;
+      break;
+    default:
+      server.workers = 0;
+    }
+  }
+  if (server.workers < 1 || memory_mb < 1 || optind < argc) {
+    std::cerr << "Usage: " << argv[0]
+              << " [-s socket] [-w workers] [-m memory MB] [-j job dir]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  server.budget = (size_t)memory_mb << 20;
+  server.running = 0;
+  server.memory_used = 0;
+  server.next_id = 1;
+  server.stopping = false;
+  mkdir(server.job_dir.c_str(), 0755);
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = request_stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  if (open_socket(&server) < 0) {
+    return EXIT_FAILURE;
+  }
+  std::cout << "Listening on " << server.socket_path << " with "
+            << server.workers << " workers and " << memory_mb << " MB"
+            << std::endl;
+  serve(&server);
+  for (auto &entry : server.clients) {
+    close(entry.first);
+  }
+  return EXIT_SUCCESS;
+}
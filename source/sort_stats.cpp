@@ -0,0 +1,192 @@
+#include "../headers/sort_stats.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+thread_local SortCounters sort_counters;
+
+/*
+ * The sort being tracked, if any
+ */
+struct SortTracker {
+  SortStats *stats;
+  SortProgressCallback progress;
+  void *progress_arg;
+  double progress_interval;
+  double last_progress;
+  long blocks_total;
+  double start_wall;
+  double start_cpu;
+  SortCounters start_counters;
+  // The current phase
+  bool in_phase;
+  PhaseStats phase;
+  double phase_wall;
+  double phase_cpu;
+  SortCounters phase_counters;
+};
+
+static SortTracker tracker;
+static bool tracking = false;
+
+extern double stats_clock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_clock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static SortCounters counters_since(const SortCounters &start) {
+  SortCounters diff;
+  diff.blocks_read = sort_counters.blocks_read - start.blocks_read;
+  diff.blocks_written = sort_counters.blocks_written - start.blocks_written;
+  diff.comparisons = sort_counters.comparisons - start.comparisons;
+  diff.records_moved = sort_counters.records_moved - start.records_moved;
+  diff.io_wait_seconds = sort_counters.io_wait_seconds - start.io_wait_seconds;
+  return diff;
+}
+
+/*
+ * Reports the progress of the sort, if the interval has passed
+ */
+extern void stats_tick() {
+  if (!tracking || tracker.progress == NULL) {
+    return;
+  }
+  double now = stats_clock();
+  if (now - tracker.last_progress < tracker.progress_interval) {
+    return;
+  }
+  tracker.last_progress = now;
+
+  SortProgress progress;
+  progress.phase = tracker.in_phase ? tracker.phase.name : "";
+  progress.blocks_done =
+      sort_counters.blocks_read - tracker.start_counters.blocks_read;
+  progress.blocks_total = tracker.blocks_total > progress.blocks_done
+                              ? tracker.blocks_total
+                              : progress.blocks_done;
+  progress.elapsed_seconds = now - tracker.start_wall;
+  progress.eta_seconds =
+      progress.blocks_done > 0
+          ? progress.elapsed_seconds *
+                (progress.blocks_total - progress.blocks_done) /
+                progress.blocks_done
+          : 0;
+  tracker.progress(&progress, tracker.progress_arg);
+}
+
+extern void stats_begin_sort(SortStats *stats, SortProgressCallback progress,
+                             void *progress_arg, double progress_interval) {
+  *stats = SortStats();
+  tracker.stats = stats;
+  tracker.progress = progress;
+  tracker.progress_arg = progress_arg;
+  tracker.progress_interval = progress_interval;
+  tracker.blocks_total = 0;
+  tracker.start_wall = stats_clock();
+  tracker.last_progress = tracker.start_wall;
+  tracker.start_cpu = cpu_clock();
+  tracker.start_counters = sort_counters;
+  tracker.in_phase = false;
+  tracking = true;
+}
+
+extern void stats_end_sort() {
+  if (!tracking) {
+    return;
+  }
+  stats_end_phase();
+  SortStats *stats = tracker.stats;
+  stats->wall_seconds = stats_clock() - tracker.start_wall;
+  stats->cpu_seconds = cpu_clock() - tracker.start_cpu;
+  stats->totals = counters_since(tracker.start_counters);
+  tracking = false;
+}
+
+extern void stats_begin_phase(const char *name) {
+  if (!tracking) {
+    return;
+  }
+  stats_end_phase();
+  memset(&tracker.phase, 0, sizeof(tracker.phase));
+  strncpy(tracker.phase.name, name, SORT_PHASE_NAME_SIZE - 1);
+  tracker.phase_wall = stats_clock();
+  tracker.phase_cpu = cpu_clock();
+  tracker.phase_counters = sort_counters;
+  tracker.in_phase = true;
+}
+
+extern void stats_end_phase() {
+  if (!tracking || !tracker.in_phase) {
+    return;
+  }
+  tracker.phase.wall_seconds = stats_clock() - tracker.phase_wall;
+  tracker.phase.cpu_seconds = cpu_clock() - tracker.phase_cpu;
+  tracker.phase.counters = counters_since(tracker.phase_counters);
+  tracker.stats->phases.push_back(tracker.phase);
+  tracker.in_phase = false;
+}
+
+/*
+ * Sets the number of blocks the whole sort is expected to read
+ * (for the progress estimates)
+ */
+extern void stats_expect_blocks(long blocks_total) {
+  if (tracking) {
+    tracker.blocks_total = blocks_total;
+  }
+}
+
+static void write_counters(FILE *json, const SortCounters &counters) {
+  fprintf(json,
+          "\"blocks_read\": %ld, \"blocks_written\": %ld, "
+          "\"comparisons\": %ld, \"records_moved\": %ld, "
+          "\"io_wait_seconds\": %.6f",
+          counters.blocks_read, counters.blocks_written, counters.comparisons,
+          counters.records_moved, counters.io_wait_seconds);
+}
+
+/*
+ * Writes the statistics of a sort as JSON.
+ * Returns 0 on success, -1 otherwise
+ */
+extern int stats_write_json(const SortStats *stats, const char *filename) {
+  FILE *json = fopen(filename, "w");
+  if (json == NULL) {
+    perror("Error creating the statistics file");
+    return -1;
+  }
+  fprintf(json,
+          "{\n  \"input_records\": %ld, \"output_records\": %ld,\n"
+          "  \"runs\": %zu, \"run_blocks\": [",
+          stats->input_records, stats->output_records,
+          stats->run_blocks.size());
+  for (size_t run = 0; run < stats->run_blocks.size(); run++) {
+    fprintf(json, "%s%ld", run > 0 ? ", " : "", stats->run_blocks[run]);
+  }
+  fprintf(json,
+          "],\n  \"merge_steps\": %d, \"merge_passes\": %.3f, "
+          "\"temp_peak_blocks\": %ld,\n"
+          "  \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, ",
+          stats->merge_steps, stats->merge_passes, stats->temp_peak_blocks,
+          stats->wall_seconds, stats->cpu_seconds);
+  write_counters(json, stats->totals);
+  fprintf(json, ",\n  \"phases\": [\n");
+  for (size_t i = 0; i < stats->phases.size(); i++) {
+    const PhaseStats &phase = stats->phases[i];
+    fprintf(json,
+            "    {\"name\": \"%s\", \"wall_seconds\": %.6f, "
+            "\"cpu_seconds\": %.6f, ",
+            phase.name, phase.wall_seconds, phase.cpu_seconds);
+    write_counters(json, phase.counters);
+    fprintf(json, "}%s\n", i + 1 < stats->phases.size() ? "," : "");
+  }
+  fprintf(json, "  ]\n}\n");
+  return fclose(json) == 0 ? 0 : -1;
+}
@@ -1,10 +1,20 @@
+#include "../headers/arena.h"
+#include "../headers/bloom.h"
+#include "../headers/buffer_pool.h"
+#include "../headers/checkpoint.h"
+#include "../headers/delta.h"
+#include "../headers/merge_plan.h"
 #include "../headers/record.h"
+#include "../headers/run_codec.h"
+#include "../headers/sort_stats.h"
 #include "../headers/sorted.h"
 #include "../headers/u_functions.h"
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <iostream>
 #include <sstream>
+#include <thread>
 
 /*
  * The next 3 functions handle the most often used BF operations
@@ -27,23 +37,42 @@ int get_new_block(int file_id) {
 }
 
 void write_block(int file_id, int block_num) {
+  double start = stats_clock();
   if (BF_WriteBlock(file_id, block_num) < 0) {
     std::cerr << "Error writing block #" << block_num << std::endl;
     BF_PrintError("Write");
     exit(1);
   }
+  count_block_written(stats_clock() - start);
+  // Any cached copy of the block is now stale
+  Pool_InvalidateBlock(file_id, block_num);
 }
 
 void *read_block(int file_id, int block_num) {
   void *beg;
+  double start = stats_clock();
   if (BF_ReadBlock(file_id, block_num, &beg) < 0) {
     std::cerr << "Error reading block #" << block_num << std::endl;
     BF_PrintError("Read");
     exit(1);
   }
+  count_block_read(stats_clock() - start);
   return beg;
 }
 
+/*
+ * Returns the first block that holds records. Sorted files keep their
+ * Bloom filter in the blocks right after the description block
+ */
+int first_data_block(void *header) {
+  int *file_type = (int *)header + FILE_TYPE_OFFSET;
+  if (*file_type != HEAP_FILE) {
+    return 0;
+  }
+  int *bloom_blocks = (int *)header + BLOOM_BLOCKS_OFFSET;
+  return 1 + *bloom_blocks;
+}
+
 /*
  * Creates a heap file and sets its type to HEAP_FILE
  * and an indicator that it is not sorted
@@ -75,14 +104,16 @@ int Sorted_CreateFile(const char *filename) {
   *sorted_offset = FILE_NOT_SORTED;
 
   write_block(file_desc, new_block);
+  BF_CloseFile(file_desc);
   return 0;
 }
 
 /*
  * Creates a file, sets its type to a HEAP_FILE, an indicator that it is sorted,
- * and the field by which it is sorted
+ * and the field by which it is sorted.
+ * It also reserves <bloom_blocks> (zeroed) blocks for the key's Bloom filter
  */
-int create_sorted_file(const char *filename, int fieldNo) {
+int create_sorted_file(const char *filename, int fieldNo, int bloom_blocks) {
   if (BF_CreateFile(filename) < 0) {
     BF_PrintError("Error in creation");
     return -1;
@@ -107,7 +138,16 @@ int create_sorted_file(const char *filename, int fieldNo) {
   int *sorted_by_offset = (int *)beg + SORTED_BY_OFFSET;
   *sorted_by_offset = fieldNo;
 
+  int *bloom_blocks_offset = (int *)beg + BLOOM_BLOCKS_OFFSET;
+  *bloom_blocks_offset = bloom_blocks;
+
   write_block(file_desc, new_block);
+
+  for (int i = 0; i < bloom_blocks; i++) {
+    get_new_block(file_desc);
+  }
+
+  BF_CloseFile(file_desc);
   return 0;
 }
 
@@ -120,69 +160,645 @@ int Sorted_OpenFile(const char *filename) {
     BF_PrintError("Error in opening (Sorted_OpenFile)");
     return -1;
   }
+  // The descriptor may have belonged to another (cached) file before
+  Pool_InvalidateFile(file_desc);
+  delta_register(file_desc, filename);
   return file_desc;
 }
 
 /*
- * Simply closes the file
+ * Flushes the records inserted into the file, drops its cached blocks
+ * and closes it. If the file's deltas have grown large enough,
+ * they are then merged into it
+ */
+int Sorted_CloseFile(const int file_desc) {
+  std::string filename;
+  bool compact = delta_close(file_desc, &filename);
+  Pool_InvalidateFile(file_desc);
+  int result = BF_CloseFile(file_desc);
+  if (compact && delta_compact(filename.c_str()) < 0) {
+    return -1;
+  }
+  return result;
+}
+
+/*
+ * Merges the deltas of a sorted file into it.
+ * The file must not be open
  */
-int Sorted_CloseFile(const int file_desc) { return BF_CloseFile(file_desc); }
+int Sorted_CompactFile(const char *filename) {
+  return delta_compact(filename);
+}
 
 /*
- * Inserts the given record into the given file
+ * Inserts the given record into the given file.
+ * Heap files get the record appended, while sorted files
+ * keep it in their memtable (and later in a delta file)
  */
 int Sorted_InsertEntry(int file_desc, Record record) {
+  void *header = read_block(file_desc, 0);
+  if (*((int *)header + SORTED_FILE_OFFSET) == FILE_SORTED) {
+    return delta_insert(file_desc, record);
+  }
+
   int block_num = BF_GetBlockCounter(file_desc) - 1;
   // We first check if a block other that the description
-  // block has been created
-  if (block_num <= 0) {
+  // (and Bloom filter) blocks has been created
+  if (block_num < first_data_block(header)) {
     block_num = get_new_block(file_desc);
   }
 
-  // Then we check if there is enough room for one more
-  // record to be saved on the current block
+  // Then we try to save the record on the current block
   void *beg = read_block(file_desc, block_num);
 
-  int *filled_spots = (int *)beg + FILLED_OFFSET;
-
-  // If not, we allocate a new block, update
-  // all the pointers to the current block (for later use)
-  // and continue
-  if (*filled_spots == MAX_RECORDS) {
+  // If there isn't enough room left for it, we allocate a new block
+  // and save it there
+  if (!add_record(record, beg)) {
     block_num = get_new_block(file_desc);
     beg = read_block(file_desc, block_num);
-    filled_spots = (int *)beg + FILLED_OFFSET;
+    add_record(record, beg);
   }
 
-  // We save the record
-  save_record(record, *filled_spots, beg);
-
-  // and increase the block's filled spots
-  (*filled_spots)++;
   write_block(file_desc, block_num);
 
   return 0;
 }
 
-void print_file_filled(int file_desc) {
-  int max = BF_GetBlockCounter(file_desc);
-  for (int i = 1; i < max; i++) {
-    void *beg = read_block(file_desc, i);
-    int *filled = (int *)beg + FILLED_OFFSET;
-    // std::cout << "Block #" << i << "\nFilled: " << *filled << std::endl;
+/*
+ * Creates the sorted file <filename>, with a Bloom filter sized for
+ * <num_records> keys, and opens it for output
+ */
+int sorted_output_open(SortedOutput *out, const char *filename, int fieldNo,
+                       long num_records) {
+  out->fieldNo = fieldNo;
+  out->bloom_blocks = bloom_block_count(num_records);
+  if (create_sorted_file(filename, fieldNo, out->bloom_blocks) < 0) {
+    return -1;
+  }
+  if ((out->file_desc = Sorted_OpenFile(filename)) < 0) {
+    return -1;
+  }
+  out->filter = new unsigned char[out->bloom_blocks * BLOCK_SIZE]();
+  out->buffer = new Record[BUFFER_SIZE];
+  out->buffer_size = 0;
+  out->num_records = 0;
+  return 0;
+}
+
+void sorted_output_add(SortedOutput *out, const Record &rec) {
+  sort_counters.records_moved++;
+  bloom_add(out->filter, out->bloom_blocks, bloom_hash(rec, out->fieldNo));
+  out->buffer[out->buffer_size++] = rec;
+  out->num_records++;
+  if (out->buffer_size == BUFFER_SIZE) {
+    flush_buffer(out->buffer, out->file_desc, out->buffer_size);
+    out->buffer_size = 0;
+  }
+}
+
+void sorted_output_close(SortedOutput *out) {
+  if (out->buffer_size > 0) {
+    flush_buffer(out->buffer, out->file_desc, out->buffer_size);
+  }
+  void *header = read_block(out->file_desc, 0);
+  *((int *)header + RECORD_COUNT_OFFSET) = (int)out->num_records;
+  write_block(out->file_desc, 0);
+
+  // The filter blocks come right after the description block
+  write_bloom_filter(out->file_desc, 1, out->filter, out->bloom_blocks);
+  Sorted_CloseFile(out->file_desc);
+  delete[] out->buffer;
+  delete[] out->filter;
+}
+
+/*
+ * The slot of <block> in a window's table of blocks: the one that holds
+ * it, or the empty (-1) one it would go into
+ */
+static int *window_slot(int *table, int mask, int block) {
+  int slot = (int)(((unsigned int)block * 2654435761u) & (unsigned int)mask);
+  while (table[slot] != -1 && table[slot] != block) {
+    slot = (slot + 1) & mask;
+  }
+  return &table[slot];
+}
+
+/*
+ * Gather pass of the key/record id mode: the key entries (read from the
+ * sorted <run> of the spill file) are materialized into full records, in order.
+ * The entries are taken in windows that touch at most <window_blocks>
+ * distinct heap file blocks. The blocks of a window are read once, in
+ * ascending order, and then the window's records are emitted from memory.
+ * Every buffer of the pass comes from the sort's <arena>.
+ * If <limit> is set, only the first <limit> entries are gathered
+ */
+static void gather_records(int heap_desc, SpillFile *spill, int run,
+                           int fieldNo, int window_blocks, long limit,
+                           SortArena *arena, SortedOutput *out) {
+  ArenaMark mark = arena_mark(arena);
+  RunReader *reader = arena_readers(arena, 1);
+  run_reader_open(reader, spill, run, fieldNo);
+
+  // A window holds at most every slot of its blocks
+  char *frames = arena_array<char>(arena, (long)window_blocks * BLOCK_SIZE);
+  KeyEntry *window =
+      arena_array<KeyEntry>(arena, (long)window_blocks * PAGE_MAX_RECORDS);
+  int *blocks = arena_array<int>(arena, window_blocks);
+  int table_size = 1;
+  while (table_size < 2 * window_blocks) {
+    table_size <<= 1;
+  }
+  int *table = arena_array<int>(arena, table_size);
+
+  KeyEntry entry;
+  long gathered = 0;
+  bool has_entry = run_read(reader, &entry);
+
+  while (has_entry) {
+    int window_size = 0;
+    int num_blocks = 0;
+    std::fill(table, table + table_size, -1);
+
+    // Collect the window (the entry that would exceed it starts the next one)
+    while (has_entry) {
+      int *slot = window_slot(table, table_size - 1, entry.block);
+      if (*slot == -1) {
+        if (num_blocks == window_blocks) {
+          break;
+        }
+        *slot = entry.block;
+        blocks[num_blocks++] = entry.block;
+      }
+      window[window_size++] = entry;
+      gathered++;
+      has_entry = (limit == 0 || gathered < limit) && run_read(reader, &entry);
+    }
+
+    // Read the window's blocks in ascending order
+    std::sort(blocks, blocks + num_blocks);
+    for (int frame = 0; frame < num_blocks; frame++) {
+      memcpy(frames + (long)frame * BLOCK_SIZE,
+             read_block(heap_desc, blocks[frame]), BLOCK_SIZE);
+    }
+
+    for (int i = 0; i < window_size; i++) {
+      const KeyEntry &key = window[i];
+      long frame = std::lower_bound(blocks, blocks + num_blocks, key.block) -
+                   blocks;
+      sorted_output_add(out, get_record(key.slot, frames + frame * BLOCK_SIZE));
+    }
+  }
+
+  arena_release(arena, mark);
+}
+
+/*
+ * Sorts a load of <size> entries in place (using <scratch>, which holds
+ * a whole load). Loads that are already in order are left as they are and
+ * strictly descending ones are reversed (which keeps the sort stable,
+ * since no two of their keys are equal)
+ */
+template <typename Entry>
+static void sort_load(Entry *load, int size, int fieldNo, Entry *scratch) {
+  bool ascending = true;
+  bool descending = true;
+  for (int i = 1; i < size && (ascending || descending); i++) {
+    if (checkLessThan(load[i], load[i - 1], fieldNo)) {
+      ascending = false;
+    } else {
+      descending = false;
+    }
+  }
+
+  if (ascending) {
+    return;
+  }
+  if (descending) {
+    std::reverse(load, load + size);
+    return;
+  }
+  merge_sort(load, 0, size - 1, fieldNo, scratch);
+}
+
+/*
+ * The last initial run: a chain of spill runs (one for every load),
+ * along with its smallest and largest entries
+ */
+template <typename Entry> struct RunChain {
+  int head;
+  int tail;
+  Entry first;
+  Entry last;
+};
+
+/*
+ * Sorts a load and writes it into a new spill run. If the whole load
+ * comes after the last initial run (in input and in sorted order) it is
+ * appended to it. If it is strictly smaller than the run, it is prepended.
+ * Otherwise it starts a new initial run.
+ * Presorted (or reverse sorted) input ends up as one initial run,
+ * and no merges are needed at all.
+ * If <collapse> is set, equal keys of the load are collapsed (and a load
+ * is only appended to a run if it starts with a greater key).
+ * If <limit> is set, only the first <limit> entries of the load are kept.
+ * Returns the number of entries written
+ */
+template <typename Entry>
+static int add_load(SpillFile *spill, SortArena *arena, Entry *load,
+                    Entry *scratch, int size, int fieldNo, bool collapse,
+                    long limit, RunChain<Entry> *chain, std::vector<int> *runs,
+                    std::vector<long> *run_blocks) {
+  if (size == 0) {
+    return 0;
+  }
+  sort_load(load, size, fieldNo, scratch);
+  if (collapse) {
+    size = collapse_entries(load, size, fieldNo);
+  }
+  if (limit > 0 && size > limit) {
+    size = (int)limit;
+  }
+
+  RunWriter &writer = arena->writer;
+  int run = spill_create_run(spill);
+  run_writer_open(&writer, spill, run, fieldNo);
+  for (int i = 0; i < size; i++) {
+    run_write(&writer, load[i]);
+  }
+  run_writer_close(&writer);
+
+  // The chain is only compared once it holds a run
+  bool appends =
+      !runs->empty() &&
+      (collapse ? checkLessThan(chain->last, load[0], fieldNo)
+                : !checkLessThan(load[0], chain->last, fieldNo));
+  if (appends) {
+    spill_link_runs(spill, chain->tail, run);
+    chain->tail = run;
+    chain->last = load[size - 1];
+    run_blocks->back() += writer.blocks;
+  } else if (!runs->empty() &&
+             checkLessThan(load[size - 1], chain->first, fieldNo)) {
+    spill_link_runs(spill, run, chain->head);
+    chain->head = run;
+    chain->first = load[0];
+    runs->back() = run;
+    run_blocks->back() += writer.blocks;
+  } else {
+    chain->head = run;
+    chain->tail = run;
+    chain->first = load[0];
+    chain->last = load[size - 1];
+    runs->push_back(run);
+    run_blocks->push_back(writer.blocks);
+  }
+  return size;
+}
+
+/*
+ * Lowers the cutoff of a sort with a limit: once a load holds at least
+ * <limit> entries, nothing that is not smaller than its <limit>-th one
+ * can make it to the output (later entries with an equal key come after
+ * it, since the sort is stable).
+ * Groups are the exception, since a record with the cutoff's key still
+ * counts towards its group
+ */
+static bool before_cutoff(const Record &rec, const Record &cutoff,
+                          int fieldNo) {
+  return checkLessThan(rec, cutoff, fieldNo);
+}
+
+static bool before_cutoff(const KeyEntry &entry, const KeyEntry &cutoff,
+                          int fieldNo) {
+  return checkLessThan(entry, cutoff, fieldNo);
+}
+
+static bool before_cutoff(const GroupEntry &group, const GroupEntry &cutoff,
+                          int fieldNo) {
+  return !checkLessThan(cutoff, group, fieldNo);
+}
+
+template <typename Entry>
+static void update_cutoff(const Entry *load, int size, long limit,
+                          int fieldNo, Entry *cutoff, bool *has_cutoff) {
+  if (limit == 0 || size < limit) {
+    return;
+  }
+  const Entry &candidate = load[limit - 1];
+  if (!*has_cutoff || checkLessThan(candidate, *cutoff, fieldNo)) {
+    *cutoff = candidate;
+    *has_cutoff = true;
+  }
+}
+
+/*
+ * The entries held by the runs of every kind of sort
+ */
+static void make_entry(Record *entry, Record rec, int fieldNo, int block,
+                       int slot) {
+  *entry = rec;
+}
+
+static void make_entry(KeyEntry *entry, Record rec, int fieldNo, int block,
+                       int slot) {
+  *entry = make_key_entry(rec, fieldNo, block, slot);
+}
+
+static void make_entry(GroupEntry *entry, Record rec, int fieldNo, int block,
+                       int slot) {
+  *entry = make_group_entry(rec, fieldNo);
+}
+
+/*
+ * Generates the initial runs of a sort.
+ * Every <memory_blocks> blocks of the heap file are turned into entries,
+ * sorted, and then either extend the last initial run or start a new one.
+ * With a limit, entries that are past the cutoff are dropped as soon as
+ * they are read (and the limit itself applies to every run).
+ * The load, its scratch space and the block buffer come from the <arena>.
+ * The number of records read is stored in <input_records>.
+ * Returns the number of entries written
+ */
+template <typename Entry>
+static long generate_runs(int file_desc, int first_block, int n, int fieldNo,
+                          long memory_blocks, bool collapse, long limit,
+                          SpillFile *spill, SortArena *arena,
+                          std::vector<int> *runs, std::vector<long> *run_blocks,
+                          long *input_records) {
+  ArenaMark mark = arena_mark(arena);
+  Record *buffer = arena_array<Record>(arena, BUFFER_SIZE);
+  Entry *load = arena_array<Entry>(arena, memory_blocks * BUFFER_SIZE);
+  Entry *scratch = arena_array<Entry>(arena, memory_blocks * BUFFER_SIZE);
+  RunChain<Entry> chain = {};
+  Entry cutoff;
+  bool has_cutoff = false;
+  long total_entries = 0;
+  *input_records = 0;
+
+  // We start at the first block that contains records
+  for (int block_number = first_block; block_number < n;) {
+    int load_size = 0;
+    for (long loaded = 0; loaded < memory_blocks && block_number < n;
+         loaded++, block_number++) {
+      int block_size;
+      fill_buffer(buffer, read_block(file_desc, block_number), &block_size);
+      *input_records += block_size;
+      for (int rec_num = 0; rec_num < block_size; rec_num++) {
+        Entry &entry = load[load_size];
+        make_entry(&entry, buffer[rec_num], fieldNo, block_number, rec_num);
+        if (!has_cutoff || before_cutoff(entry, cutoff, fieldNo)) {
+          load_size++;
+        }
+      }
+    }
+
+    // Sort it and add it to the initial runs
+    int written = add_load(spill, arena, load, scratch, load_size, fieldNo,
+                           collapse, limit, &chain, runs, run_blocks);
+    update_cutoff(load, written, limit, fieldNo, &cutoff, &has_cutoff);
+    total_entries += written;
+  }
+
+  arena_release(arena, mark);
+  return total_entries;
+}
+
+/*
+ * Writes the groups of the final run as CSV lines:
+ * <key>,<count>,<smallest id>,<largest id>
+ */
+static int write_groups(SpillFile *spill, int run, int fieldNo, long limit,
+                        SortArena *arena, const char *filename) {
+  FILE *stream = fopen(filename, "w");
+  if (stream == NULL) {
+    perror("Error creating group by file");
+    return -1;
+  }
+  RunReader *reader = arena_readers(arena, 1);
+  run_reader_open(reader, spill, run, fieldNo);
+  GroupEntry group;
+  long written = 0;
+  while ((limit == 0 || written < limit) && run_read(reader, &group)) {
+    if (fieldNo == 0) {
+      unsigned int id = ((unsigned int)group.key[0] << 24) |
+                        ((unsigned int)group.key[1] << 16) |
+                        ((unsigned int)group.key[2] << 8) | group.key[3];
+      fprintf(stream, "%d", (int)(id ^ 0x80000000u));
+    } else {
+      fprintf(stream, "\"%.*s\"", group.key_len, (const char *)group.key);
+    }
+    fprintf(stream, ",%d,%d,%d\n", group.count, group.min_id, group.max_id);
+    written++;
+  }
+  fclose(stream);
+  return 0;
+}
+
+/*
+ * A record along with its position in the heap file,
+ * which breaks ties so that the top K stay stable
+ */
+struct RankedRecord {
+  Record record;
+  long position;
+};
+
+/*
+ * Top K when K records fit in memory: a single scan of the heap file
+ * keeps the <limit> smallest records in a max-heap, taken from the sort's
+ * arena (see top_k_bytes()).
+ * Points <top> at them, in order, and returns their number
+ */
+static long top_k_heap(int file_desc, int first_block, int n, int fieldNo,
+                       long limit, SortArena *arena, RankedRecord **top) {
+  auto ranks_before = [fieldNo](const RankedRecord &a, const RankedRecord &b) {
+    if (checkLessThan(a.record, b.record, fieldNo)) {
+      return true;
+    }
+    return !checkLessThan(b.record, a.record, fieldNo) &&
+           a.position < b.position;
+  };
+
+  RankedRecord *heap = arena_array<RankedRecord>(arena, limit);
+  long heap_size = 0;
+  ArenaMark mark = arena_mark(arena);
+  Record *buffer = arena_array<Record>(arena, BUFFER_SIZE);
+  long position = 0;
+  for (int block_number = first_block; block_number < n; block_number++) {
+    int block_size;
+    fill_buffer(buffer, read_block(file_desc, block_number), &block_size);
+    for (int rec_num = 0; rec_num < block_size; rec_num++) {
+      RankedRecord ranked = {buffer[rec_num], position++};
+      if (heap_size < limit) {
+        heap[heap_size++] = ranked;
+        std::push_heap(heap, heap + heap_size, ranks_before);
+      } else if (ranks_before(ranked, heap[0])) {
+        std::pop_heap(heap, heap + heap_size, ranks_before);
+        heap[heap_size - 1] = ranked;
+        std::push_heap(heap, heap + heap_size, ranks_before);
+      }
+    }
+  }
+  arena_release(arena, mark);
+
+  std::sort_heap(heap, heap + heap_size, ranks_before);
+  *top = heap;
+  return heap_size;
+}
+
+/*
+ * The bytes of a top K with a heap (see top_k_heap())
+ */
+static size_t top_k_bytes(long limit) {
+  return arena_bytes(limit * sizeof(RankedRecord)) +
+         arena_bytes(BUFFER_SIZE * sizeof(Record));
+}
+
+/*
+ * The sorted file of a sort, which depends on its limit and aggregate
+ */
+static char *output_file_name(const char *filename, int fieldNo,
+                              const SortOptions *options, long limit) {
+  if (options->aggregate == SORT_AGGREGATE_DISTINCT) {
+    return get_aggregate_file_name(filename, fieldNo, options->aggregate);
+  }
+  if (limit > 0) {
+    return get_top_file_name(filename, fieldNo, limit);
+  }
+  return get_sorted_file_name(filename, fieldNo);
+}
+
+/*
+ * Sorts a heap file whose records all fit in memory at once: they are
+ * loaded straight from its blocks, sorted in place by <threads> threads
+ * (see parallel_merge_sort()) and written into the sorted file in one
+ * sequential pass, with no spill file and no runs.
+ * The number of records read is stored in <input_records>.
+ * Returns the number of records written, or -1 on failure
+ */
+static long sort_in_memory(int file_desc, int first_block, int n, int fieldNo,
+                           bool distinct, long limit, int threads,
+                           SortArena *arena, const char *sorted_file_name,
+                           long *input_records) {
+  long capacity = (long)(n - first_block) * BUFFER_SIZE;
+  Record *load = arena_array<Record>(arena, capacity);
+  Record *scratch = arena_array<Record>(arena, capacity);
+  int size = 0;
+  for (int block_number = first_block; block_number < n; block_number++) {
+    int block_size;
+    fill_buffer(load + size, read_block(file_desc, block_number), &block_size);
+    size += block_size;
+  }
+  *input_records = size;
+
+  if (threads <= 0) {
+    threads = (int)std::thread::hardware_concurrency();
+  }
+  parallel_merge_sort(load, size, fieldNo, scratch, threads);
+  if (distinct) {
+    size = collapse_entries(load, size, fieldNo);
+  }
+  if (limit > 0 && size > limit) {
+    size = (int)limit;
+  }
+
+  stats_begin_phase("output");
+  SortedOutput out;
+  if (sorted_output_open(&out, sorted_file_name, fieldNo, size) < 0) {
+    return -1;
+  }
+  for (int i = 0; i < size; i++) {
+    sorted_output_add(&out, load[i]);
+  }
+  sorted_output_close(&out);
+  return out.num_records;
+}
+
+/*
+ * The size of a sort's arena: enough for its run generation (the load,
+ * its scratch space and a block buffer) or, for a limit that fits in
+ * memory, its top K heap and, in SORT_MODE_KEYS, for its gather pass.
+ * The merges need much less than either
+ */
+/*
+ * Whether the sort is a top K that fits in memory, which a bounded heap
+ * is enough for
+ */
+static bool top_k_fits(const SortOptions *options, long memory_blocks) {
+  return options->limit > 0 && options->limit <= memory_blocks * BUFFER_SIZE &&
+         options->aggregate == SORT_AGGREGATE_NONE;
+}
+
+template <typename Entry>
+static size_t generation_bytes(long memory_blocks) {
+  return arena_bytes(BUFFER_SIZE * sizeof(Record)) +
+         arena_bytes(memory_blocks * BUFFER_SIZE * sizeof(Entry)) +
+         arena_bytes(memory_blocks * BUFFER_SIZE * sizeof(Entry));
+}
+
+static size_t sort_arena_size(const SortOptions *options, long memory_blocks) {
+  if (top_k_fits(options, memory_blocks)) {
+    return std::max(generation_bytes<Record>(memory_blocks),
+                    top_k_bytes(options->limit));
+  }
+  if (options->aggregate == SORT_AGGREGATE_GROUP_BY) {
+    return generation_bytes<GroupEntry>(memory_blocks);
+  }
+  if (options->mode != SORT_MODE_KEYS) {
+    return generation_bytes<Record>(memory_blocks);
+  }
+  long window_blocks = options->gather_blocks;
+  size_t gather = arena_bytes(window_blocks * BLOCK_SIZE) +
+                  arena_bytes(window_blocks * PAGE_MAX_RECORDS *
+                              sizeof(KeyEntry)) +
+                  arena_bytes(window_blocks * sizeof(int)) +
+                  arena_bytes(4 * window_blocks * sizeof(int));
+  return std::max(generation_bytes<KeyEntry>(memory_blocks), gather);
+}
+
+extern size_t Sorted_SortMemory(const SortOptions *options) {
+  long memory_blocks = options->memory_blocks > 0 ? options->memory_blocks : 1;
+  size_t memory = sort_arena_size(options, memory_blocks);
+  // In direct mode every run of a merge, and its output, also holds
+  // an extent buffer of the spill file
+  if (options->direct_io) {
+    int fan_in = merge_fan_in(memory_blocks, options->max_open_runs, true);
+    memory += (size_t)(fan_in + 1) * SPILL_EXTENT_BLOCKS * BLOCK_SIZE;
   }
+  return memory;
 }
 
 /*
- * Sorts a given heap file
+ * Sorts a given heap file, using the default options
  */
 extern int Sorted_SortFile(const char *filename, int fieldNo) {
-  if (fieldNo > 3 && fieldNo < 0) {
+  SortOptions options;
+  return Sorted_SortFileWithOptions(filename, fieldNo, &options);
+}
+
+/*
+ * Sorts a given heap file.
+ * In SORT_MODE_RECORDS the runs hold whole records.
+ * In SORT_MODE_KEYS the runs only hold (key, record id) entries,
+ * and the records are gathered from the heap file at the end.
+ * Every buffer of the sort comes from one arena (see arena.h).
+ * Its statistics are kept in <stats>
+ */
+static int sort_file(const char *filename, int fieldNo,
+                     const SortOptions *options, SortStats *stats) {
+  if (fieldNo > 3 || fieldNo < 0) {
     std::cerr << "Unknown field number. Exiting..." << std::endl;
     return -1;
   }
-  system("exec mkdir ../tmp_files");
+  bool key_mode = options->mode == SORT_MODE_KEYS;
+  bool distinct = options->aggregate == SORT_AGGREGATE_DISTINCT;
+  bool group_by = options->aggregate == SORT_AGGREGATE_GROUP_BY;
   std::cout << "Sorting file: " << filename << std::endl;
+  // The sort only reads the file's own blocks, so the deltas of a sorted
+  // file are merged into it first (see delta.h)
+  if (delta_compact(filename) < 0) {
+    return -1;
+  }
   int file_desc;
   if ((file_desc = BF_OpenFile(filename)) < 0) {
     BF_PrintError("Error opening heap file");
@@ -199,7 +815,9 @@ extern int Sorted_SortFile(const char *filename, int fieldNo) {
 
   // Then, we check whether the file is already sorted.
   int *sorted_offset = (int *)beginning + SORTED_FILE_OFFSET;
-  if (*sorted_offset == FILE_SORTED) {
+  long limit = options->limit > 0 ? options->limit : 0;
+  if (*sorted_offset == FILE_SORTED && limit == 0 &&
+      options->aggregate == SORT_AGGREGATE_NONE) {
     int *sorted_by = (int *)beginning + SORTED_BY_OFFSET;
     if (*sorted_by == fieldNo) {
       std::cout << "File already sorted by " + field_number_value(fieldNo)
@@ -207,137 +825,259 @@ extern int Sorted_SortFile(const char *filename, int fieldNo) {
       return 0;
     }
   }
+  int first_block = first_data_block(beginning);
 
   int n = BF_GetBlockCounter(file_desc);
-
-  // If there is an odd number of max blocks, we will be creating
-  // max_blocks + 1 files, since we need an even number of files
-  int max_files = n % 2 == 0 ? n : n + 1;
-  int curr_run = 0;
-
-  // We create <max_files> files (and keep a vector of the names)
-  std::vector<std::string> file_names = create_files(max_files, curr_run);
-
-  // We need the last output file's name because it's the one that is sorted
-  std::string last_outp_file_name;
-
-  // We need an input buffer to fill and flush
-  Record *buffer = new Record[BUFFER_SIZE];
-
-  // We start at the first block that contains records.
-  // We fill each of the newly created files' first block with
-  // one block from the unsorted input file
-  for (int block_number = 1; block_number < n; block_number++) {
-    beginning = read_block(file_desc, block_number);
-    int block_size;
-
-    // Fill the buffer with the next block of the starting heap file
-    fill_buffer(buffer, beginning, &block_size);
-
-    // Sort it
-    merge_sort(buffer, 0, block_size - 1, fieldNo);
-
-    int tmp_desc;
-
-    // Open the next temporary file
-    if ((tmp_desc = BF_OpenFile(file_names[block_number - 1].c_str())) < 0) {
-      BF_PrintError("Error opening file");
+  long memory_blocks = options->memory_blocks > 0 ? options->memory_blocks : 1;
+  SortArena arena;
+  arena_open(&arena, sort_arena_size(options, memory_blocks));
+
+  // If the top <limit> records fit in memory, a bounded heap is enough
+  if (top_k_fits(options, memory_blocks)) {
+    stats_expect_blocks(n - first_block);
+    stats_begin_phase("top-k");
+    RankedRecord *top;
+    long top_size =
+        top_k_heap(file_desc, first_block, n, fieldNo, limit, &arena, &top);
+    char *top_file_name = get_top_file_name(filename, fieldNo, limit);
+    SortedOutput out;
+    if (sorted_output_open(&out, top_file_name, fieldNo, top_size) < 0) {
+      BF_CloseFile(file_desc);
+      arena_close(&arena);
+      delete[] top_file_name;
       return -1;
     }
-
-    // And flush the buffer into its first block
-    flush_buffer(buffer, tmp_desc, block_size);
-
-    BF_CloseFile(tmp_desc);
-    print_file_filled(file_desc);
+    for (long i = 0; i < top_size; i++) {
+      sorted_output_add(&out, top[i].record);
+    }
+    sorted_output_close(&out);
+    stats->output_records = out.num_records;
+    BF_CloseFile(file_desc);
+    arena_close(&arena);
+    delete[] top_file_name;
+    return 0;
   }
 
-  delete[] buffer;
-
-  do {
-    // After each run, we will have ceil(n / 2) output files
-    n = (int)ceil(n / 2);
-
-    // same logic as above
-    max_files = n % 2 == 0 ? n : n + 1;
-    int output_file_num = 0;
-
-    // Create output files
-    create_files(max_files, ++curr_run);
-
-    for (int file_num = 0; file_num < n * 2; file_num += 2) {
-
-      // Open 2 input and one output file
-      std::string inp1_name = get_tmp_file_name(file_num, curr_run - 1);
-      std::string inp2_name = get_tmp_file_name(file_num + 1, curr_run - 1);
-      std::string outp_name = get_tmp_file_name(output_file_num++, curr_run);
-
-      int inp1_desc, inp2_desc, outp_desc;
-      inp1_desc = BF_OpenFile(inp1_name.c_str());
-      inp2_desc = BF_OpenFile(inp2_name.c_str());
-      outp_desc = BF_OpenFile(outp_name.c_str());
-
-      if (inp1_desc < 0 || inp2_desc < 0 || outp_desc < 0) {
-        BF_PrintError("Unable to open file");
-        return -1;
-      }
-
-      // Merge the two input files into one output file
-      merge_into_block(inp1_desc, inp2_desc, outp_desc, fieldNo);
-
-      // Keep track of the last output file's name
-      last_outp_file_name = outp_name;
+  // A heap file whose records fit in the memory of a records sort is
+  // sorted in memory (groups are still written from a run)
+  long data_blocks = n - first_block;
+  if (!group_by && data_blocks <= memory_blocks &&
+      generation_bytes<Record>(data_blocks) <=
+          sort_arena_size(options, memory_blocks)) {
+    stats_expect_blocks(data_blocks);
+    stats_begin_phase("in-memory sort");
+    char *sorted_file_name = output_file_name(filename, fieldNo, options, limit);
+    long written = sort_in_memory(file_desc, first_block, n, fieldNo, distinct,
+                                  limit, options->threads, &arena,
+                                  sorted_file_name, &stats->input_records);
+    stats->output_records = written;
+    BF_CloseFile(file_desc);
+    arena_close(&arena);
+    delete[] sorted_file_name;
+    return written < 0 ? -1 : 0;
+  }
 
-      // If (for any reason) the temporary output file is not sorted,
-      // we don't continue with the sorting. Used for debugging.
-      // Comment it out/remove it for the programme to run faster
-      if (Sorted_CheckSortedFile(inp1_name.c_str(), fieldNo) == 1) {
-        std::cerr << "Temporary file not sorted. Exiting..." << std::endl;
-        return -1;
-      }
+  // Every temporary run lives in one spill file. A checkpointed sort
+  // may pick up the runs of an earlier attempt (see checkpoint.h)
+  int fan_in = merge_fan_in(memory_blocks, options->max_open_runs,
+                            options->direct_io);
+  bool journaled = options->checkpoint_dir != NULL;
+  SortJournal journal;
+  SortCheckpoint checkpoint;
+  checkpoint.merges_done = -1;
+  SpillFile spill;
+  int opened;
+  if (journaled) {
+    stats_begin_phase("resume");
+    opened = journal_open(&journal, filename, fieldNo, options, fan_in);
+    if (opened == 0) {
+      opened = journal_resume(&journal, &spill, options->direct_io,
+                              &checkpoint);
+    }
+  } else {
+    opened = spill_open(&spill, options->temp_dir, options->direct_io);
+  }
+  if (opened < 0) {
+    BF_CloseFile(file_desc);
+    arena_close(&arena);
+    return -1;
+  }
 
-      // Close the temporary files
-      BF_CloseFile(inp1_desc);
-      BF_CloseFile(inp2_desc);
-      BF_CloseFile(outp_desc);
+  // The initial runs, in order, and their sizes
+  std::vector<int> &runs = checkpoint.runs;
+  std::vector<long> &run_blocks = checkpoint.run_blocks;
+
+  // The number of records of the final run (to size the Bloom filter)
+  long &total_records = checkpoint.total_records;
+  if (checkpoint.merges_done < 0) {
+    // Until the merges are planned, we expect to read the file twice
+    stats_expect_blocks(2 * (long)(n - first_block));
+    stats_begin_phase("run generation");
+    if (group_by) {
+      total_records = generate_runs<GroupEntry>(
+          file_desc, first_block, n, fieldNo, memory_blocks, true, limit,
+          &spill, &arena, &runs, &run_blocks, &checkpoint.input_records);
+    } else if (key_mode) {
+      total_records = generate_runs<KeyEntry>(
+          file_desc, first_block, n, fieldNo, memory_blocks, distinct, limit,
+          &spill, &arena, &runs, &run_blocks, &checkpoint.input_records);
+    } else {
+      total_records = generate_runs<Record>(
+          file_desc, first_block, n, fieldNo, memory_blocks, distinct, limit,
+          &spill, &arena, &runs, &run_blocks, &checkpoint.input_records);
     }
 
-    // After all the input files have been merged into output ones, delete them
-    remove_input_files(n * 2, curr_run - 1);
+    // An empty heap file still gets an (empty) sorted file
+    if (runs.empty()) {
+      runs.push_back(spill_create_run(&spill));
+      run_blocks.push_back(0);
+    }
+    checkpoint.merges_done = 0;
+    if (journaled && journal_write(&journal, &spill, &checkpoint) < 0) {
+      spill_close(&spill);
+      BF_CloseFile(file_desc);
+      arena_close(&arena);
+      return -1;
+    }
+  }
+  stats->input_records = checkpoint.input_records;
+
+  // Merge the runs according to the plan. The outputs of the steps
+  // are appended to <runs>, so that the plan's run numbers are its indexes
+  long blocks_read;
+  std::vector<MergeStep> plan = plan_merges(run_blocks, fan_in, &blocks_read);
+  long initial_blocks = 0;
+  for (long blocks : run_blocks) {
+    initial_blocks += blocks;
+  }
+  stats->run_blocks = run_blocks;
+  stats->merge_steps = (int)plan.size();
+  stats->merge_passes =
+      initial_blocks > 0 ? (double)blocks_read / initial_blocks : 0;
+  stats_expect_blocks((n - first_block) + blocks_read + initial_blocks);
+
+  for (size_t i = (size_t)checkpoint.merges_done; i < plan.size(); i++) {
+    const MergeStep &step = plan[i];
+    char phase_name[SORT_PHASE_NAME_SIZE];
+    snprintf(phase_name, sizeof(phase_name), "merge %zu", i + 1);
+    stats_begin_phase(phase_name);
+    std::vector<int> inputs;
+    for (int input : step.inputs) {
+      inputs.push_back(runs[input]);
+    }
+    int outp_run = spill_create_run(&spill);
+    if (group_by) {
+      total_records = merge_groups_into_run(&spill, inputs, outp_run,
+                                            fieldNo, limit, &arena);
+    } else if (key_mode) {
+      total_records = merge_keys_into_run(&spill, inputs, outp_run, fieldNo,
+                                          limit, distinct, &arena);
+    } else {
+      total_records = merge_into_run(&spill, inputs, outp_run, fieldNo, limit,
+                                     distinct, &arena);
+    }
 
-    // We stop once n / 2 == 1
-  } while (n != 1);
+    // The input runs' space is reused by the rest of the merges
+    for (int input : inputs) {
+      spill_free_run(&spill, input);
+    }
+    runs.push_back(outp_run);
+    checkpoint.merges_done = (int)i + 1;
+    // The last checkpoint that was written is kept, so a retry
+    // still picks up from there
+    if (journaled && journal_write(&journal, &spill, &checkpoint) < 0) {
+      spill_close(&spill);
+      BF_CloseFile(file_desc);
+      arena_close(&arena);
+      return -1;
+    }
+  }
+  int last_run = runs.back();
+  stats->temp_peak_blocks = spill.num_extents * SPILL_EXTENT_BLOCKS;
+  if (limit > 0 && total_records > limit) {
+    total_records = limit;
+  }
+  stats_begin_phase("output");
+
+  // Groups are written out as CSV
+  if (group_by) {
+    char *group_file_name =
+        get_aggregate_file_name(filename, fieldNo, options->aggregate);
+    int result = write_groups(&spill, last_run, fieldNo, limit, &arena,
+                              group_file_name);
+    stats->output_records = total_records;
+    spill_close(&spill);
+    if (journaled && result == 0) {
+      journal_remove(&journal);
+    }
+    BF_CloseFile(file_desc);
+    arena_close(&arena);
+    delete[] group_file_name;
+    return result;
+  }
 
-  // We create a new file where we will copy the sorted file
+  // We create a new file where we will write the sorted records
   // (plus the extra information we need)
-  create_sorted_file(get_sorted_file_name(filename, fieldNo), fieldNo);
-
-  // We copy each of the last output file's records into the final Sorted file
-  int outp_file_desc = Sorted_OpenFile(get_sorted_file_name(filename, fieldNo));
-
-  if ((file_desc = BF_OpenFile(last_outp_file_name.c_str())) < 0) {
-    BF_PrintError("Error opening file");
+  char *sorted_file_name = output_file_name(filename, fieldNo, options, limit);
+  SortedOutput out;
+  if (sorted_output_open(&out, sorted_file_name, fieldNo, total_records) < 0) {
+    // The journal is kept: every merge is done, so a checkpointed retry
+    // only has to write the output
+    spill_close(&spill);
+    BF_CloseFile(file_desc);
+    arena_close(&arena);
+    delete[] sorted_file_name;
     return -1;
   }
 
-  int last_file_max_blocks = BF_GetBlockCounter(file_desc);
-
-  for (int last_file_block_num = 0; last_file_block_num < last_file_max_blocks;
-       last_file_block_num++) {
-
-    void *beg = read_block(file_desc, last_file_block_num);
-    int *filled_spots = (int *)beg + FILLED_OFFSET;
-    for (int rec_num = 0; rec_num < *filled_spots; rec_num++) {
-      Record rec = get_record(rec_num, beg);
-      Sorted_InsertEntry(outp_file_desc, rec);
+  if (key_mode) {
+    gather_records(file_desc, &spill, last_run, fieldNo, options->gather_blocks,
+                   limit, &arena, &out);
+  } else {
+    // We decode the last run's records into the final Sorted file
+    RunReader *reader = arena_readers(&arena, 1);
+    run_reader_open(reader, &spill, last_run, fieldNo);
+    Record rec;
+    while ((limit == 0 || out.num_records < limit) && run_read(reader, &rec)) {
+      sorted_output_add(&out, rec);
     }
   }
+  sorted_output_close(&out);
+  stats->output_records = out.num_records;
 
-  // We delete the tmp file folder
-  system("exec rm -rf ../tmp_files");
+  spill_close(&spill);
+  if (journaled) {
+    journal_remove(&journal);
+  }
+  BF_CloseFile(file_desc);
+  arena_close(&arena);
+  delete[] sorted_file_name;
   return 0;
 }
 
+/*
+ * Sorts a given heap file (see sort_file()), keeping its statistics
+ * in <options->stats> and/or writing them to <options->stats_json>.
+ * With <options->direct_io>, the heap file is then dropped from the
+ * page cache
+ */
+extern int Sorted_SortFileWithOptions(const char *filename, int fieldNo,
+                                      const SortOptions *options) {
+  SortStats local_stats;
+  SortStats *stats = options->stats != NULL ? options->stats : &local_stats;
+  stats_begin_sort(stats, options->progress, options->progress_arg,
+                   options->progress_interval);
+  int result = sort_file(filename, fieldNo, options, stats);
+  if (options->direct_io) {
+    drop_page_cache(filename);
+  }
+  stats_end_sort();
+  if (result == 0 && options->stats_json != NULL) {
+    result = stats_write_json(stats, options->stats_json);
+  }
+  return result;
+}
+
 /*
  * Goes through the whole file. If a record's <fieldNo> value is greater
  * than the previous record's value, we return false. Otherwise, we return true
@@ -360,13 +1100,10 @@ extern int Sorted_CheckSortedFile(const char *filename, int fieldNo) {
     return -1;
   }
 
-  int first_block = 0;
   void *beg = read_block(file_desc, 0);
 
-  int *file_type = (int *)beg + FILE_TYPE_OFFSET;
-  if (*file_type == HEAP_FILE && max_blocks > 1) {
-    first_block = 1;
-  }
+  // Skip the description (and Bloom filter) blocks
+  int first_block = first_data_block(beg);
 
   // If the file is indicated to be sorted but by a different fieldNo,
   // we notify the user and continue at their command only
@@ -393,166 +1130,296 @@ extern int Sorted_CheckSortedFile(const char *filename, int fieldNo) {
       } while (inp != 'n' && inp != 'N' && inp != 'y' && inp != 'Y');
     }
   }
-  int *filled_spots;
+  int filled_spots;
   Record curr_record;
   Record prev_record;
-  // Check each record contained inside the file.
+  bool has_prev = false;
+  // Check each record contained inside the file
+  // (each block's first record is checked against the previous block's last)
   for (int block_num = first_block; block_num < max_blocks; block_num++) {
     beg = read_block(file_desc, block_num);
-    filled_spots = (int *)beg + FILLED_OFFSET;
-    prev_record = get_record(0, beg);
-    for (int record_num = 1; record_num < *filled_spots; record_num++) {
+    filled_spots = get_record_count(beg);
+    for (int record_num = 0; record_num < filled_spots; record_num++) {
       curr_record = get_record(record_num, beg);
-      if (!checkLessThan(prev_record, curr_record, fieldNo) &&
+      if (has_prev && !checkLessThan(prev_record, curr_record, fieldNo) &&
           !checkEqual(prev_record, curr_record, fieldNo)) {
         std::cerr << "File not sorted" << std::endl;
         return -1;
       }
       copy_record(&prev_record, curr_record);
+      has_prev = true;
     }
   }
   BF_CloseFile(file_desc);
   return 0;
 }
 
-void Sorted_GetAllEntries(int file_desc, int *fieldNo, void *value) {
-  if (*fieldNo > 3 && *fieldNo < 0) {
-    std::cerr << "Unknown field number. Exiting..." << std::endl;
-    return;
-  }
+/*
+ * Looks <value> up in a single sorted file: the Bloom filter is probed
+ * first and then the data blocks are binary searched.
+ * The matching records are printed (if <print> is set)
+ * and their number is returned
+ */
+static int search_sorted_file(int file_desc, int fieldNo, void *value,
+                              int *blocks_read, bool print) {
   int max_blocks = BF_GetBlockCounter(file_desc);
   int records_found = 0;
-  int records_read = 0;
   void *beg;
-  int *filled_spots;
-  int starting_block = 0;
-  beg = read_block(file_desc, 0);
-  int *sorted_offset = (int *)beg + SORTED_FILE_OFFSET;
-  if (*sorted_offset != FILE_SORTED) {
+  int filled_spots;
+
+  beg = Pool_PinBlock(file_desc, 0);
+  int starting_block = first_data_block(beg);
+  int bloom_blocks = *((int *)beg + BLOOM_BLOCKS_OFFSET);
+  Pool_UnpinBlock(file_desc, 0);
+
+  /*
+   * The Bloom filter lets us reject most absent values with a single
+   * block read, without touching any of the data blocks
+   */
+  if (bloom_blocks > 0) {
+    unsigned long hash = bloom_hash(value, fieldNo);
+    int filter_block = 1 + bloom_block_index(bloom_blocks, hash);
+    beg = Pool_PinBlock(file_desc, filter_block);
+    (*blocks_read)++;
+    bool may_contain = bloom_block_may_contain((unsigned char *)beg, hash);
+    Pool_UnpinBlock(file_desc, filter_block);
+    if (!may_contain) {
+      return 0;
+    }
+  }
+
+  int lowest = starting_block;
+  int highest = max_blocks;
+  int middle;
+  Record rec;
+  bool found = false;
+  bool exists = true;
+  while ((highest - lowest) != 0) {
+    middle = (int)ceil((highest + lowest) / 2);
+    beg = Pool_PinBlock(file_desc, middle);
+    (*blocks_read)++;
+    rec = get_record(0, beg);
+    /*
+     * If the first record's fieldNo is equal to the given
+     * value, we have found it, so we print the surrounding
+     * records
+     */
+    if (checkEqual(rec, value, fieldNo)) {
+      Pool_UnpinBlock(file_desc, middle);
+      int tmp_blocks_read;
+      records_found =
+          print_surrounding_records(middle, file_desc, 0, value, fieldNo,
+                                    &tmp_blocks_read, print);
+      *blocks_read += tmp_blocks_read;
+      found = true;
+      break;
+
+      /*
+       * If it's greater than the value, we go to the first half
+       * of the block span and check again
+       */
+    } else if (!checkLessThan(rec, value, fieldNo)) {
+      Pool_UnpinBlock(file_desc, middle);
+      highest = middle;
+
+      /*
+       * If it's less than the value, we search inside the block
+       * (in a serial manner). If we find it, we print the
+       * surrounding records
+       */
+    } else {
+      filled_spots = get_record_count(beg);
+      for (int rec_num = 1; rec_num < filled_spots; rec_num++) {
+        rec = get_record(rec_num, beg);
+        if (checkEqual(rec, value, fieldNo)) {
+          int tmp_blocks_read;
+          records_found =
+              print_surrounding_records(middle, file_desc, rec_num, value,
+                                        fieldNo, &tmp_blocks_read, print);
+          *blocks_read += tmp_blocks_read;
+          found = true;
+          break;
+        } else if (!checkLessThan(rec, value, fieldNo)) {
+
+          /*
+           * If, while inside a block whose first record
+           * was less than the value we are searching
+           * for, we reach a record with a greater value
+           * while *not* having found a record,
+           * we know that the records does not exist
+           */
+          exists = false;
+          break;
+        }
+      }
+      Pool_UnpinBlock(file_desc, middle);
+      if (!exists || found) {
+        break;
+      }
+
+      /*
+       * If we have searched through the whole block
+       * and have not found the record we are looking for,
+       * we search in the upper half of the block span
+       */
+
+      lowest = middle + 1;
+    }
+  }
+  if (print) {
+    std::cout << "Max blocks are: " << max_blocks << std::endl;
+  }
+  return records_found;
+}
+
+static void print_merged_record(const Record &record, void *records_found) {
+  print_record(record);
+  (*(int *)records_found)++;
+}
+
+/*
+ * Checks that the file can be searched by <fieldNo> and lists the names
+ * of its delta files in <delta_names>. Returns 0, or -1 (with a message)
+ * if the file is not sorted by <fieldNo>
+ */
+static int lookup_open(int file_desc, int fieldNo,
+                       std::vector<std::string> *delta_names) {
+  if (fieldNo > 3 || fieldNo < 0) {
+    std::cerr << "Unknown field number. Exiting..." << std::endl;
+    return -1;
+  }
+  void *beg;
+
+  /*
+   * Lookups go through the buffer pool, so the description block,
+   * the filter and the upper levels of the binary search of a hot file
+   * stay in memory across calls
+   */
+  beg = Pool_PinBlock(file_desc, 0);
+  int sorted = *((int *)beg + SORTED_FILE_OFFSET);
+  int sorted_by = *((int *)beg + SORTED_BY_OFFSET);
+  int num_deltas = *((int *)beg + DELTA_COUNT_OFFSET);
+  Pool_UnpinBlock(file_desc, 0);
+
+  if (sorted != FILE_SORTED) {
     std::cerr << "Given file is not sorted. Binary search will "
                  "not work. Exiting..."
               << std::endl;
-    return;
+    return -1;
   }
 
-  int *sorted_by = (int *)beg + SORTED_BY_OFFSET;
-  if (*sorted_by != *fieldNo) {
-    std::cerr << "Given file is sorted by " << field_number_value(*sorted_by)
+  if (sorted_by != fieldNo) {
+    std::cerr << "Given file is sorted by " << field_number_value(sorted_by)
               << " while the requested field number is "
-              << field_number_value(*fieldNo)
+              << field_number_value(fieldNo)
               << ". The results will not be accurate. Exiting..." << std::endl;
-    return;
+    return -1;
   }
-  int *file_type = (int *)beg + FILE_TYPE_OFFSET;
-  if (*file_type == HEAP_FILE) {
-    starting_block = 1;
+
+  // The records inserted since the sort live in the file's deltas
+  // and its memtable
+  const char *base_name = delta_base_name(file_desc);
+  if (num_deltas > 0 && base_name == NULL) {
+    std::cerr << "File was not opened with Sorted_OpenFile, "
+                 "its delta files will be ignored"
+              << std::endl;
+  } else {
+    for (int delta = 0; delta < num_deltas; delta++) {
+      delta_names->push_back(delta_file_name(base_name, delta));
+    }
   }
+  return 0;
+}
 
-  /*
-   * We print all of the records
-   */
-  if (value == NULL) {
-    for (int block_num = starting_block; block_num < max_blocks; block_num++) {
-      beg = read_block(file_desc, block_num);
-      filled_spots = (int *)beg + FILLED_OFFSET;
-      if (*filled_spots == 0) {
-        std::cerr << "Filled spots are 0" << std::endl;
-        return;
-      }
-      for (int record_index = 0; record_index < *filled_spots; record_index++) {
-        records_found++;
-        records_read++;
-        Record rec = get_record(record_index, beg);
-        print_record(rec);
+/*
+ * Looks <value> up in the file, every one of its <delta_names> and its
+ * memtable. The matching records are printed (if <print> is set)
+ * and their number is returned
+ */
+static long search_entries(int file_desc, int fieldNo, void *value,
+                           const std::vector<std::string> &delta_names,
+                           int *blocks_read, bool print) {
+  long records_found =
+      search_sorted_file(file_desc, fieldNo, value, blocks_read, print);
+  for (const std::string &delta_name : delta_names) {
+    int delta_desc;
+    if ((delta_desc = BF_OpenFile(delta_name.c_str())) < 0) {
+      BF_PrintError("Error opening delta file");
+      exit(1);
+    }
+    Pool_InvalidateFile(delta_desc);
+    records_found +=
+        search_sorted_file(delta_desc, fieldNo, value, blocks_read, print);
+    Pool_InvalidateFile(delta_desc);
+    BF_CloseFile(delta_desc);
+  }
+  for (const Record &record : delta_memtable(file_desc, fieldNo)) {
+    if (checkEqual(record, value, fieldNo)) {
+      if (print) {
+        print_record(record);
       }
+      records_found++;
     }
+  }
+  return records_found;
+}
 
-    // We perform binary search until we find one or more records that match the
-    // given value, or if none exists
-  } else {
-    int lowest = 0;
-    int highest = max_blocks;
-    int middle;
-    Record rec;
-    bool found = false;
-    bool exists = true;
-    while ((highest - lowest) != 0) {
-      middle = (int)ceil((highest + lowest) / 2);
-      beg = read_block(file_desc, middle);
-      records_read++;
-      rec = get_record(0, beg);
-      /*
-       * If the first record's fieldNo is equal to the given
-       * value, we have found it, so we print the surrounding
-       * records
-       */
-      if (checkEqual(rec, value, *fieldNo)) {
-        int tmp_rec_read;
-        records_found = print_surrounding_records(middle, file_desc, 0, value,
-                                                  *fieldNo, &tmp_rec_read);
-        records_read += tmp_rec_read;
-        found = true;
-
-        /*
-         * If it's greater than the value, we go to the first half
-         * of the block span and check again
-         */
-      } else if (!checkLessThan(rec, value, *fieldNo)) {
-        highest = middle;
-
-        /*
-         * If it's less than the value, we search inside the block
-         * (in a serial manner). If we find it, we print the
-         * surrounding records
-         */
-      } else {
-        filled_spots = (int *)beg + FILLED_OFFSET;
-        for (int rec_num = 1; rec_num < *filled_spots; rec_num++) {
-          rec = get_record(rec_num, beg);
-          if (checkEqual(rec, value, *fieldNo)) {
-            int tmp_rec_read;
-            records_found = print_surrounding_records(
-                middle, file_desc, rec_num, value, *fieldNo, &tmp_rec_read);
-            records_read += tmp_rec_read;
-            found = true;
-          } else if (!checkLessThan(rec, value, *fieldNo)) {
-
-            /*
-             * If, while inside a block whose first record
-             * was less than the value we are searching
-             * for, we reach a record with a greater value
-             * while *not* having found a record,
-             * we know that the records does not exist
-             */
-            exists = false;
-            break;
-          }
-        }
-        if (!exists || found) {
-          break;
-        }
+long Sorted_CountEntries(int file_desc, int fieldNo, void *value) {
+  std::vector<std::string> delta_names;
+  if (lookup_open(file_desc, fieldNo, &delta_names) < 0) {
+    return -1;
+  }
+  int blocks_read = 0;
+  return search_entries(file_desc, fieldNo, value, delta_names, &blocks_read,
+                        false);
+}
 
-        /*
-         * If we have searched through the whole block
-         * and have not found the record we are looking for,
-         * we search in the upper half of the block span
-         */
+void Sorted_GetAllEntries(int file_desc, int *fieldNo, void *value) {
+  std::vector<std::string> delta_names;
+  if (lookup_open(file_desc, *fieldNo, &delta_names) < 0) {
+    return;
+  }
+  int records_found = 0;
+  int blocks_read = 0;
 
-        lowest = middle;
+  /*
+   * We print all of the records, merging the file with its deltas
+   */
+  if (value == NULL) {
+    std::vector<Record> memtable = delta_memtable(file_desc, *fieldNo);
+    std::vector<SortedSource> sources(delta_names.size() + 2);
+    std::vector<int> delta_descs;
+    source_open_file(&sources[0], file_desc);
+    for (size_t delta = 0; delta < delta_names.size(); delta++) {
+      int delta_desc;
+      if ((delta_desc = BF_OpenFile(delta_names[delta].c_str())) < 0) {
+        BF_PrintError("Error opening delta file");
+        exit(1);
       }
+      delta_descs.push_back(delta_desc);
+      source_open_file(&sources[delta + 1], delta_desc);
+    }
+    source_open_records(&sources.back(), &memtable);
+    merge_sources(sources, *fieldNo, print_merged_record, &records_found);
+    for (int delta_desc : delta_descs) {
+      BF_CloseFile(delta_desc);
     }
-    std::cout << "Max blocks are: " << max_blocks << std::endl;
 
-    if (found) {
-      if (records_found > 1) {
-        std::cout << "Found " << records_found << " records" << std::endl;
-      } else {
-        std::cout << "Found 1 record" << std::endl;
-      }
-    } else if (!exists) {
-      std::cout << "No records could be found with the requested";
+    // We perform binary search until we find one or more records that match the
+    // given value, or if none exists (in the file and in every delta)
+  } else {
+    records_found = (int)search_entries(file_desc, *fieldNo, value,
+                                        delta_names, &blocks_read, true);
+
+    if (records_found > 1) {
+      std::cout << "Found " << records_found << " records" << std::endl;
+    } else if (records_found == 1) {
+      std::cout << "Found 1 record" << std::endl;
+    } else {
+      std::cout << "No records could be found with the requested value"
+                << std::endl;
     }
 
-    std::cout << "Read " << records_read << " records" << std::endl;
+    std::cout << "Read " << blocks_read << " blocks" << std::endl;
   }
 }
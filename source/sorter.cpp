@@ -0,0 +1,261 @@
+#include "../headers/sorter.h"
+#include "../headers/merge_plan.h"
+#include "../headers/sorted.h"
+#include "../headers/u_functions.h"
+#include <algorithm>
+#include <iostream>
+
+static bool sorter_less(const ExternalSorter *sorter, const Record &rec,
+                        const Record &other) {
+  const SorterOptions &options = sorter->options;
+  if (options.less != NULL) {
+    return options.less(rec, other, options.less_arg);
+  }
+  return checkLessThan(rec, other, options.fieldNo);
+}
+
+/*
+ * Sorts the buffered records (stably)
+ */
+static void sort_buffer(ExternalSorter *sorter) {
+  std::vector<Record> &buffer = sorter->buffer;
+  if (buffer.size() < 2) {
+    return;
+  }
+  if (sorter->options.less == NULL) {
+    sorter->scratch.resize(buffer.size());
+    merge_sort(buffer.data(), 0, (int)buffer.size() - 1,
+               sorter->options.fieldNo, sorter->scratch.data());
+    return;
+  }
+  std::stable_sort(buffer.begin(), buffer.end(),
+                   [sorter](const Record &rec, const Record &other) {
+                     return sorter_less(sorter, rec, other);
+                   });
+}
+
+/*
+ * Sorts the buffered records into a run of the spill file,
+ * which is opened by the first spill
+ */
+static int spill_buffer(ExternalSorter *sorter) {
+  if (!sorter->spilled) {
+    if (spill_open(&sorter->spill, sorter->options.temp_dir,
+                   sorter->options.direct_io) < 0) {
+      return -1;
+    }
+    sorter->spilled = true;
+  }
+  sort_buffer(sorter);
+  int run = spill_create_run(&sorter->spill);
+  run_writer_open(&sorter->writer, &sorter->spill, run,
+                  sorter->options.fieldNo);
+  for (const Record &rec : sorter->buffer) {
+    run_write(&sorter->writer, rec);
+  }
+  run_writer_close(&sorter->writer);
+  sorter->runs.push_back(run);
+  sorter->run_blocks.push_back(sorter->writer.blocks);
+  sorter->buffer.clear();
+  return 0;
+}
+
+/*
+ * Opens a merge of <inputs> (its readers and heap)
+ */
+static void open_merge(ExternalSorter *sorter, const std::vector<int> &inputs) {
+  int num_inputs = (int)inputs.size();
+  sorter->readers.resize((size_t)num_inputs);
+  sorter->current.resize((size_t)num_inputs);
+  sorter->heap.clear();
+  for (int i = 0; i < num_inputs; i++) {
+    run_reader_open(&sorter->readers[i], &sorter->spill, inputs[i],
+                    sorter->options.fieldNo);
+    if (run_read(&sorter->readers[i], &sorter->current[i])) {
+      sorter->heap.push_back(i);
+    }
+  }
+}
+
+/*
+ * Orders the heap of the merge. On equal records the input that comes
+ * first goes first, so that the sort stays stable
+ */
+static bool comes_after(const ExternalSorter *sorter, int a, int b) {
+  const Record &rec_a = sorter->current[a];
+  const Record &rec_b = sorter->current[b];
+  if (sorter_less(sorter, rec_b, rec_a)) {
+    return true;
+  }
+  return !sorter_less(sorter, rec_a, rec_b) && a > b;
+}
+
+/*
+ * Takes the next record out of the merge
+ */
+static bool merge_next(ExternalSorter *sorter, Record *record) {
+  std::vector<int> &heap = sorter->heap;
+  auto after = [sorter](int a, int b) { return comes_after(sorter, a, b); };
+  if (heap.empty()) {
+    return false;
+  }
+  std::pop_heap(heap.begin(), heap.end(), after);
+  int next = heap.back();
+  *record = sorter->current[next];
+  if (run_read(&sorter->readers[next], &sorter->current[next])) {
+    std::push_heap(heap.begin(), heap.end(), after);
+  } else {
+    heap.pop_back();
+  }
+  return true;
+}
+
+/*
+ * Runs a merge step of the plan: merges its inputs into a new run
+ */
+static int merge_step(ExternalSorter *sorter, const MergeStep &step) {
+  std::vector<int> inputs;
+  for (int input : step.inputs) {
+    inputs.push_back(sorter->runs[input]);
+  }
+  open_merge(sorter, inputs);
+  std::make_heap(sorter->heap.begin(), sorter->heap.end(),
+                 [sorter](int a, int b) { return comes_after(sorter, a, b); });
+  int run = spill_create_run(&sorter->spill);
+  run_writer_open(&sorter->writer, &sorter->spill, run,
+                  sorter->options.fieldNo);
+  Record rec;
+  while (merge_next(sorter, &rec)) {
+    run_write(&sorter->writer, rec);
+  }
+  run_writer_close(&sorter->writer);
+  for (int input : inputs) {
+    spill_free_run(&sorter->spill, input);
+  }
+  return run;
+}
+
+extern int Sorter_Open(ExternalSorter *sorter, const SorterOptions *options) {
+  if (options->less == NULL &&
+      (options->fieldNo < 0 || options->fieldNo > 3)) {
+    std::cerr << "Unknown field number. Exiting..." << std::endl;
+    return -1;
+  }
+  sorter->options = *options;
+  // Half of the memory is the merge sort's scratch space
+  sorter->capacity = options->memory_bytes / (2 * sizeof(Record));
+  if (sorter->capacity < BUFFER_SIZE) {
+    sorter->capacity = BUFFER_SIZE;
+  }
+  sorter->buffer.clear();
+  sorter->buffer.reserve(sorter->capacity);
+  sorter->spilled = false;
+  sorter->runs.clear();
+  sorter->run_blocks.clear();
+  sorter->finished = false;
+  sorter->next = 0;
+  sorter->heap.clear();
+  sorter->records = 0;
+  return 0;
+}
+
+extern int Sorter_Push(ExternalSorter *sorter, const Record &record) {
+  if (sorter->finished) {
+    std::cerr << "Records can't be pushed after the sorter has finished"
+              << std::endl;
+    return -1;
+  }
+  if (sorter->buffer.size() == sorter->capacity && spill_buffer(sorter) < 0) {
+    return -1;
+  }
+  sorter->buffer.push_back(record);
+  sorter->records++;
+  return 0;
+}
+
+extern int Sorter_PushBatch(ExternalSorter *sorter, const Record *records,
+                            long count) {
+  for (long i = 0; i < count; i++) {
+    if (Sorter_Push(sorter, records[i]) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Ends the input. If the records didn't fit in memory, the runs are
+ * merged down to the inputs of the final merge, which Sorter_Next() pulls
+ */
+extern int Sorter_Finish(ExternalSorter *sorter) {
+  if (sorter->finished) {
+    return 0;
+  }
+  sorter->finished = true;
+  if (!sorter->spilled) {
+    sort_buffer(sorter);
+    sorter->next = 0;
+    return 0;
+  }
+  if (!sorter->buffer.empty() && spill_buffer(sorter) < 0) {
+    return -1;
+  }
+  // The scratch space isn't needed anymore
+  std::vector<Record>().swap(sorter->buffer);
+  std::vector<Record>().swap(sorter->scratch);
+
+  long memory_blocks = (long)(sorter->options.memory_bytes / BLOCK_SIZE);
+  int fan_in = merge_fan_in(memory_blocks, sorter->options.max_open_runs,
+                            sorter->options.direct_io);
+  long blocks_read;
+  std::vector<MergeStep> plan =
+      plan_merges(sorter->run_blocks, fan_in, &blocks_read);
+  // Every step but the last one is written out
+  for (size_t i = 0; i + 1 < plan.size(); i++) {
+    sorter->runs.push_back(merge_step(sorter, plan[i]));
+  }
+  std::vector<int> inputs;
+  if (plan.empty()) {
+    inputs = sorter->runs;
+  } else {
+    for (int input : plan.back().inputs) {
+      inputs.push_back(sorter->runs[input]);
+    }
+  }
+  open_merge(sorter, inputs);
+  std::make_heap(sorter->heap.begin(), sorter->heap.end(),
+                 [sorter](int a, int b) { return comes_after(sorter, a, b); });
+  return 0;
+}
+
+/*
+ * Pulls the next record in order. Returns false once every record
+ * has been pulled
+ */
+extern bool Sorter_Next(ExternalSorter *sorter, Record *record) {
+  if (!sorter->finished) {
+    return false;
+  }
+  if (sorter->spilled) {
+    return merge_next(sorter, record);
+  }
+  if (sorter->next == sorter->buffer.size()) {
+    return false;
+  }
+  *record = sorter->buffer[sorter->next++];
+  return true;
+}
+
+extern void Sorter_Close(ExternalSorter *sorter) {
+  if (sorter->spilled) {
+    spill_close(&sorter->spill);
+    sorter->spilled = false;
+  }
+  std::vector<Record>().swap(sorter->buffer);
+  std::vector<Record>().swap(sorter->scratch);
+  sorter->readers.clear();
+  sorter->current.clear();
+  sorter->heap.clear();
+  sorter->runs.clear();
+  sorter->run_blocks.clear();
+}
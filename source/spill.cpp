@@ -0,0 +1,398 @@
+#include "../headers/spill.h"
+#include "../headers/sort_stats.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+extern "C" {
+#include "../headers/BF.h"
+};
+
+/*
+ * $TMPDIR if it is set, /tmp otherwise
+ */
+extern const char *default_temp_dir() {
+  const char *dir = getenv("TMPDIR");
+  return dir != NULL && dir[0] != 0 ? dir : "/tmp";
+}
+
+static void init_spill(SpillFile *spill, bool direct, bool checksummed) {
+  spill->direct = direct;
+  spill->checksummed = checksummed;
+  spill->o_direct = false;
+  if (direct) {
+    int flags = fcntl(spill->fd, F_GETFL);
+    spill->o_direct = fcntl(spill->fd, F_SETFL, flags | O_DIRECT) == 0;
+  }
+  spill->num_extents = 0;
+  spill->allocated_extents = 0;
+  spill->free_extents.clear();
+  spill->runs.clear();
+  spill->buffers.clear();
+  spill->free_buffers.clear();
+}
+
+/*
+ * Creates the spill file inside <temp_dir> (or the default one, if NULL).
+ * If <direct> is set, it is kept out of the page cache (see spill.h)
+ */
+extern int spill_open(SpillFile *spill, const char *temp_dir, bool direct) {
+  if (temp_dir == NULL) {
+    temp_dir = default_temp_dir();
+  }
+  spill->path = std::string(temp_dir) + "/external_sort_spill_XXXXXX";
+  if ((spill->fd = mkstemp(&spill->path[0])) < 0) {
+    perror("Error creating spill file");
+    return -1;
+  }
+  unlink(spill->path.c_str());
+  init_spill(spill, direct, false);
+  return 0;
+}
+
+/*
+ * Opens the spill file <path> (of a checkpointed sort), which is kept
+ * once it is closed. Unless <truncate> is set, its contents are kept too
+ * (the run directory is then restored by the caller).
+ * Its runs are checksummed, so that they can be verified when the sort
+ * is resumed
+ */
+extern int spill_open_path(SpillFile *spill, const char *path, bool direct,
+                           bool truncate) {
+  spill->path = path;
+  int flags = O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0);
+  if ((spill->fd = open(path, flags, 0644)) < 0) {
+    perror("Error opening spill file");
+    return -1;
+  }
+  init_spill(spill, direct, true);
+  return 0;
+}
+
+/*
+ * Makes the spill file's blocks durable
+ */
+extern void spill_sync(SpillFile *spill) {
+  if (fdatasync(spill->fd) != 0) {
+    perror("Error syncing spill file");
+    exit(1);
+  }
+}
+
+/*
+ * Closes the spill file (a named one is kept) and frees its buffers
+ */
+extern void spill_close(SpillFile *spill) {
+  if (spill->fd >= 0) {
+    close(spill->fd);
+  }
+  spill->fd = -1;
+  spill->runs.clear();
+  spill->free_extents.clear();
+  for (char *buffer : spill->buffers) {
+    free(buffer);
+  }
+  spill->buffers.clear();
+  spill->free_buffers.clear();
+}
+
+/*
+ * Returns an (aligned) extent buffer, reusing a free one if possible
+ */
+static char *take_buffer(SpillFile *spill) {
+  if (!spill->free_buffers.empty()) {
+    char *buffer = spill->free_buffers.back();
+    spill->free_buffers.pop_back();
+    return buffer;
+  }
+  char *buffer = (char *)aligned_alloc(SPILL_IO_ALIGNMENT,
+                                       (size_t)SPILL_EXTENT_BLOCKS * BLOCK_SIZE);
+  if (buffer == NULL) {
+    std::cerr << "Error allocating spill buffer" << std::endl;
+    exit(1);
+  }
+  spill->buffers.push_back(buffer);
+  return buffer;
+}
+
+static void give_back_buffer(SpillFile *spill, char **buffer) {
+  if (*buffer != NULL) {
+    spill->free_buffers.push_back(*buffer);
+    *buffer = NULL;
+  }
+}
+
+/*
+ * Returns a free extent, growing (and preallocating) the file if
+ * there are none left
+ */
+static long allocate_extent(SpillFile *spill) {
+  if (!spill->free_extents.empty()) {
+    long extent = spill->free_extents.back();
+    spill->free_extents.pop_back();
+    return extent;
+  }
+
+  if (spill->num_extents == spill->allocated_extents) {
+    long extent_size = (long)SPILL_EXTENT_BLOCKS * BLOCK_SIZE;
+    int err = posix_fallocate(spill->fd, spill->allocated_extents * extent_size,
+                              SPILL_GROW_EXTENTS * extent_size);
+    if (err != 0) {
+      std::cerr << "Error preallocating spill file" << std::endl;
+      exit(1);
+    }
+    spill->allocated_extents += SPILL_GROW_EXTENTS;
+  }
+  return spill->num_extents++;
+}
+
+/*
+ * Adds an (empty) run to the run directory and returns its number
+ */
+extern int spill_create_run(SpillFile *spill) {
+  SpillRun run;
+  run.num_blocks = 0;
+  run.next = -1;
+  run.live = true;
+  run.checksum = 0;
+  run.write_buffer = NULL;
+  run.read_buffer = NULL;
+  run.read_extent = -1;
+  spill->runs.push_back(run);
+  return (int)spill->runs.size() - 1;
+}
+
+static off_t block_offset(SpillRun &run, long block_num) {
+  long extent = run.extents[block_num / SPILL_EXTENT_BLOCKS];
+  long block = extent * SPILL_EXTENT_BLOCKS + block_num % SPILL_EXTENT_BLOCKS;
+  return (off_t)block * BLOCK_SIZE;
+}
+
+/*
+ * Bytes of an extent I/O of <blocks> blocks (O_DIRECT needs whole
+ * aligned sectors, and extents are always long enough)
+ */
+static size_t extent_io_size(long blocks) {
+  long bytes = blocks * BLOCK_SIZE;
+  return (size_t)((bytes + SPILL_IO_ALIGNMENT - 1) / SPILL_IO_ALIGNMENT *
+                  SPILL_IO_ALIGNMENT);
+}
+
+/*
+ * Direct mode: writes the first <blocks> blocks of the run's write buffer
+ * into its last extent
+ */
+static void write_extent(SpillFile *spill, SpillRun &spill_run, long blocks) {
+  off_t offset = (off_t)spill_run.extents.back() * SPILL_EXTENT_BLOCKS *
+                 BLOCK_SIZE;
+  size_t size = extent_io_size(blocks);
+  if (pwrite(spill->fd, spill_run.write_buffer, size, offset) !=
+      (ssize_t)size) {
+    perror("Error writing spill file");
+    exit(1);
+  }
+  if (!spill->o_direct) {
+    posix_fadvise(spill->fd, offset, (off_t)size, POSIX_FADV_DONTNEED);
+  }
+}
+
+/*
+ * Direct mode: buffers the block, and writes the extent once it is full
+ */
+static void append_direct(SpillFile *spill, SpillRun &spill_run,
+                          const void *data) {
+  if (spill_run.write_buffer == NULL) {
+    spill_run.write_buffer = take_buffer(spill);
+  }
+  long block = spill_run.num_blocks % SPILL_EXTENT_BLOCKS;
+  memcpy(spill_run.write_buffer + block * BLOCK_SIZE, data, BLOCK_SIZE);
+  spill_run.num_blocks++;
+
+  double start = stats_clock();
+  if (block == SPILL_EXTENT_BLOCKS - 1) {
+    write_extent(spill, spill_run, SPILL_EXTENT_BLOCKS);
+  }
+  count_block_written(stats_clock() - start);
+}
+
+extern void spill_append_block(SpillFile *spill, int run, const void *data) {
+  SpillRun &spill_run = spill->runs[run];
+  if (spill_run.num_blocks % SPILL_EXTENT_BLOCKS == 0) {
+    spill_run.extents.push_back(allocate_extent(spill));
+  }
+  if (spill->checksummed) {
+    spill_run.checksum = spill_crc32(spill_run.checksum, data, BLOCK_SIZE);
+  }
+  if (spill->direct) {
+    append_direct(spill, spill_run, data);
+    return;
+  }
+  off_t offset = block_offset(spill_run, spill_run.num_blocks);
+  double start = stats_clock();
+  if (pwrite(spill->fd, data, BLOCK_SIZE, offset) != BLOCK_SIZE) {
+    perror("Error writing spill file");
+    exit(1);
+  }
+  count_block_written(stats_clock() - start);
+  spill_run.num_blocks++;
+}
+
+/*
+ * Writes out what is left of a run once it is complete
+ * (only the direct mode buffers anything)
+ */
+extern void spill_flush_run(SpillFile *spill, int run) {
+  SpillRun &spill_run = spill->runs[run];
+  if (spill_run.write_buffer == NULL) {
+    return;
+  }
+  long blocks = spill_run.num_blocks % SPILL_EXTENT_BLOCKS;
+  if (blocks > 0) {
+    double start = stats_clock();
+    write_extent(spill, spill_run, blocks);
+    sort_counters.io_wait_seconds += stats_clock() - start;
+  }
+  give_back_buffer(spill, &spill_run.write_buffer);
+}
+
+/*
+ * Direct mode: reads the whole extent of the block (up to the end of
+ * the run) into the run's read buffer, unless it is already there
+ */
+static void read_direct(SpillFile *spill, SpillRun &spill_run, long block_num,
+                        void *data) {
+  long extent = block_num / SPILL_EXTENT_BLOCKS;
+  double start = stats_clock();
+  if (spill_run.read_extent != extent) {
+    if (spill_run.read_buffer == NULL) {
+      spill_run.read_buffer = take_buffer(spill);
+    }
+    long blocks = std::min((long)SPILL_EXTENT_BLOCKS,
+                           spill_run.num_blocks - extent * SPILL_EXTENT_BLOCKS);
+    off_t offset = (off_t)spill_run.extents[extent] * SPILL_EXTENT_BLOCKS *
+                   BLOCK_SIZE;
+    size_t size = extent_io_size(blocks);
+    if (pread(spill->fd, spill_run.read_buffer, size, offset) !=
+        (ssize_t)size) {
+      perror("Error reading spill file");
+      exit(1);
+    }
+    if (!spill->o_direct) {
+      posix_fadvise(spill->fd, offset, (off_t)size, POSIX_FADV_DONTNEED);
+    }
+    spill_run.read_extent = extent;
+  }
+  memcpy(data,
+         spill_run.read_buffer + block_num % SPILL_EXTENT_BLOCKS * BLOCK_SIZE,
+         BLOCK_SIZE);
+  count_block_read(stats_clock() - start);
+}
+
+extern void spill_read_block(SpillFile *spill, int run, long block_num,
+                             void *data) {
+  if (spill->direct) {
+    read_direct(spill, spill->runs[run], block_num, data);
+    return;
+  }
+  off_t offset = block_offset(spill->runs[run], block_num);
+  double start = stats_clock();
+  if (pread(spill->fd, data, BLOCK_SIZE, offset) != BLOCK_SIZE) {
+    perror("Error reading spill file");
+    exit(1);
+  }
+  count_block_read(stats_clock() - start);
+}
+
+extern long spill_run_blocks(SpillFile *spill, int run) {
+  return spill->runs[run].num_blocks;
+}
+
+/*
+ * Makes <next> the run that follows <run> (the last run of its chain)
+ */
+extern void spill_link_runs(SpillFile *spill, int run, int next) {
+  spill->runs[run].next = next;
+}
+
+extern int spill_next_run(SpillFile *spill, int run) {
+  return spill->runs[run].next;
+}
+
+/*
+ * Returns the extents of the run (and of the rest of its chain)
+ * to the free list
+ */
+extern void spill_free_run(SpillFile *spill, int run) {
+  while (run >= 0) {
+    SpillRun &spill_run = spill->runs[run];
+    for (long extent : spill_run.extents) {
+      spill->free_extents.push_back(extent);
+    }
+    spill_run.extents.clear();
+    spill_run.num_blocks = 0;
+    spill_run.live = false;
+    spill_run.checksum = 0;
+    give_back_buffer(spill, &spill_run.write_buffer);
+    give_back_buffer(spill, &spill_run.read_buffer);
+    spill_run.read_extent = -1;
+    run = spill_run.next;
+    spill_run.next = -1;
+  }
+}
+
+/*
+ * Reads a run back and checks it against its checksum
+ */
+extern bool spill_verify_run(SpillFile *spill, int run) {
+  unsigned int crc = 0;
+  char block[BLOCK_SIZE];
+  for (long block_num = 0; block_num < spill->runs[run].num_blocks;
+       block_num++) {
+    spill_read_block(spill, run, block_num, block);
+    crc = spill_crc32(crc, block, BLOCK_SIZE);
+  }
+  return crc == spill->runs[run].checksum;
+}
+
+/*
+ * CRC-32 (the zlib/IEEE one) of <data>, continuing from <crc>
+ */
+extern unsigned int spill_crc32(unsigned int crc, const void *data,
+                                size_t len) {
+  // Built once, by the first caller (the initialization of a local static
+  // is thread safe)
+  static const std::array<unsigned int, 256> table = [] {
+    std::array<unsigned int, 256> crc_table;
+    for (unsigned int i = 0; i < 256; i++) {
+      unsigned int c = i;
+      for (int bit = 0; bit < 8; bit++) {
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      crc_table[i] = c;
+    }
+    return crc_table;
+  }();
+  const unsigned char *bytes = (const unsigned char *)data;
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+/*
+ * Drops the (clean) pages of a file from the page cache
+ */
+extern void drop_page_cache(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
@@ -1,367 +1,472 @@
+#include "../headers/arena.h"
+#include "../headers/buffer_pool.h"
+#include "../headers/run_codec.h"
 #include "../headers/sorted.h"
 #include "../headers/u_functions.h"
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <thread>
 
 /*
- * The temporary file names follow the format:
- * tmp_file_<current_run>_<number_of_file>
+ * Collapsing of equal keys (DISTINCT and GROUP BY): records and key
+ * entries keep the first one of their key, while groups add up
  */
-extern std::string get_tmp_file_name(int file_num, int curr_run) {
-  std::string tmp_file_name = "../tmp_files/tmp_file_";
-  std::stringstream *ss = new std::stringstream();
-  *ss << curr_run;
-  tmp_file_name = tmp_file_name + ss->str() + "_";
-  delete ss;
-  ss = new std::stringstream();
-  *ss << file_num;
-  tmp_file_name += ss->str();
-  delete ss;
-  return tmp_file_name;
+static void collapse_into(Record *, const Record &) {}
+
+static void collapse_into(KeyEntry *, const KeyEntry &) {}
+
+static void collapse_into(GroupEntry *group, const GroupEntry &other) {
+  combine_groups(group, other);
 }
 
 /*
- * Creates <num> temporary files for run <run>
+ * Collapses the equal keys of a sorted array in place.
+ * Returns the new size of the array
  */
-extern std::vector<std::string> create_files(int num, int run) {
-  std::vector<std::string> tmp = std::vector<std::string>((ulong)num);
-  for (int i = 0; i < num; i++) {
-    std::string tmp_name = get_tmp_file_name(i, run);
-    if (BF_CreateFile(tmp_name.c_str()) < 0) {
-      std::cerr << "Error creating file. Exiting" << std::endl;
-      exit(1);
+template <typename Entry>
+static int collapse_sorted(Entry *arr, int size, int fieldNo) {
+  if (size == 0) {
+    return 0;
+  }
+  int kept = 1;
+  for (int i = 1; i < size; i++) {
+    if (checkEqual(arr[kept - 1], arr[i], fieldNo)) {
+      collapse_into(&arr[kept - 1], arr[i]);
+    } else {
+      arr[kept++] = arr[i];
     }
-    tmp[i] = tmp_name;
   }
-  return tmp;
+  return kept;
 }
 
-/*
- * Removes the <num> temporary files created for run <run>
- */
-extern void remove_input_files(int num, int run) {
-  for (int file_num = 0; file_num < num; file_num++) {
-    std::string tmp_file_name = get_tmp_file_name(file_num, run);
-    remove(tmp_file_name.c_str());
-  }
+extern int collapse_entries(Record *arr, int size, int fieldNo) {
+  return collapse_sorted(arr, size, fieldNo);
 }
 
-/*
- * Merges the inp1_fd file and inp2_fd file into the outp_fd file
- * according to <fieldNo>
- */
-extern void merge_into_block(int inp1_fd, int inp2_fd, int outp_fd,
-                             int fieldNo) {
-
-  int inp1_max_blocks = BF_GetBlockCounter(inp1_fd);
-  int inp2_max_blocks = BF_GetBlockCounter(inp2_fd);
-  bool reached_inp1_end = false;
-  bool reached_inp2_end = false;
+extern int collapse_entries(KeyEntry *arr, int size, int fieldNo) {
+  return collapse_sorted(arr, size, fieldNo);
+}
 
-  /*
-   * The actual sorting will happen in main memory
-   * (2 buffers as input and 1 as output)
-   */
-  Record *inp1_buffer = new Record[BUFFER_SIZE];
-  Record *inp2_buffer = new Record[BUFFER_SIZE];
-  Record *output_buffer = new Record[BUFFER_SIZE];
+extern int collapse_entries(GroupEntry *arr, int size, int fieldNo) {
+  return collapse_sorted(arr, size, fieldNo);
+}
 
-  /*
-   * It can happen that the second file parameter
-   * doesn't contain any records
-   * (if we have an odd number of blocks)
-   * In that case, copy the first one into the
-   * output buffer and flush it
-   */
-  if (inp2_max_blocks == 0) {
-    bool outp_flushed = false;
-    void *inp1_beg;
-    int output_index = 0;
-    for (int block_num = 0; block_num < inp1_max_blocks; block_num++) {
-      inp1_beg = read_block(inp1_fd, block_num);
-      int inp1_size;
-      fill_buffer(inp1_buffer, inp1_beg, &inp1_size);
-      // Fill the output buffer with values from the input
-      // buffer
-      for (int record_num = 0; record_num < inp1_size; record_num++) {
-        output_buffer[output_index++] = inp1_buffer[record_num];
-        outp_flushed = false;
-
-        // Flush the output buffer once full
-        if (output_index == BUFFER_SIZE) {
-          flush_buffer(output_buffer, outp_fd, output_index);
-          output_index = 0;
-          outp_flushed = true;
-        }
-      }
+/*
+ * Merges the <inputs> runs of the spill file into the <outp> run
+ * according to <fieldNo>. Entries are decoded and encoded on the fly
+ * by the run readers/writer, and the next entry is picked with a heap
+ * that holds the current entry of every input run.
+ * The readers, the writer and the heap come from the sort's <arena>,
+ * and are given back once the merge is over.
+ * If <collapse> is set, equal keys are collapsed into one entry, and
+ * if <limit> is set, the merge stops after <limit> entries.
+ * Returns the number of entries written to the output run
+ */
+template <typename Entry>
+static long merge_runs(SpillFile *spill, const std::vector<int> &inputs,
+                       int outp_run, int fieldNo, long limit, bool collapse,
+                       SortArena *arena) {
+  int num_inputs = (int)inputs.size();
+  ArenaMark mark = arena_mark(arena);
+  RunReader *readers = arena_readers(arena, num_inputs);
+  Entry *current = arena_array<Entry>(arena, num_inputs);
+  int *heap = arena_array<int>(arena, num_inputs);
+  int heap_size = 0;
+  RunWriter &outp = arena->writer;
+  run_writer_open(&outp, spill, outp_run, fieldNo);
+
+  // On equal keys the run that comes first goes first,
+  // so that the sort stays stable
+  auto comes_after = [&](int a, int b) {
+    if (checkLessThan(current[b], current[a], fieldNo)) {
+      return true;
     }
+    return !checkLessThan(current[a], current[b], fieldNo) && a > b;
+  };
 
-    // If the input file didn't contain the max number of records,
-    // the output buffer will not have been flushed, so we flush it
-    // before exiting
-    if (!outp_flushed) {
-      flush_buffer(output_buffer, outp_fd, output_index);
+  for (int i = 0; i < num_inputs; i++) {
+    run_reader_open(&readers[i], spill, inputs[i], fieldNo);
+    if (run_read(&readers[i], &current[i])) {
+      heap[heap_size++] = i;
     }
-    return;
   }
-
-  // If both files contain blocks, we merge them into the output file
-  if (inp1_max_blocks == 0) {
-    std::cerr << "Bad input for file 1" << std::endl;
-    return;
-  }
-
-  int inp1_curr_block_num = 0;
-  int inp2_curr_block_num = 0;
-
-  // Read the first block of each input file
-  void *inp1_beg = read_block(inp1_fd, 0);
-  void *inp2_beg = read_block(inp2_fd, 0);
-
-  int inp1_size;
-  fill_buffer(inp1_buffer, inp1_beg, &inp1_size);
-  int inp2_size;
-  fill_buffer(inp2_buffer, inp2_beg, &inp2_size);
-
-  int buff1_curr_rec = 0;
-  int buff2_curr_rec = 0;
-  int outp_curr_rec = 0;
-
-  do {
-    // If the first buffer's current value is smaller, add it to the output
-    // buffer (simple merge sort)
-    if (checkLessThan(inp1_buffer[buff1_curr_rec], inp2_buffer[buff2_curr_rec],
-                      fieldNo) ||
-        checkEqual(inp1_buffer[buff1_curr_rec], inp2_buffer[buff2_curr_rec],
-                   fieldNo)) {
-      output_buffer[outp_curr_rec++] = inp1_buffer[buff1_curr_rec++];
-      if (buff1_curr_rec == inp1_size) {
-        // We have reached the end of buffer1.
-        // Fill it with the next block
-        if (++inp1_curr_block_num < inp1_max_blocks) {
-          // if it exists
-          buff1_curr_rec = 0;
-          inp1_beg = read_block(inp1_fd, inp1_curr_block_num);
-
-          // Refill the inp1 buffer
-          fill_buffer(inp1_buffer, inp1_beg, &inp1_size);
-        } else {
-          reached_inp1_end = true;
-          break;
-        }
-      }
+  std::make_heap(heap, heap + heap_size, comes_after);
+
+  // The last entry is held back until the next key shows up,
+  // so that equal keys can still be collapsed into it
+  Entry pending;
+  bool has_pending = false;
+  while (heap_size > 0 && (limit == 0 || outp.records < limit)) {
+    std::pop_heap(heap, heap + heap_size, comes_after);
+    int next = heap[heap_size - 1];
+    if (has_pending && collapse &&
+        checkEqual(pending, current[next], fieldNo)) {
+      collapse_into(&pending, current[next]);
     } else {
-      output_buffer[outp_curr_rec++] = inp2_buffer[buff2_curr_rec++];
-      if (buff2_curr_rec == inp2_size) {
-        // We have reached the end of buffer 2
-        if (++inp2_curr_block_num < inp2_max_blocks) {
-          // if it exists
-          buff2_curr_rec = 0;
-          inp2_beg = read_block(inp2_fd, inp2_curr_block_num);
-
-          // Refill the inp2 array
-          fill_buffer(inp2_buffer, inp2_beg, &inp2_size);
-        } else {
-          reached_inp2_end = true;
-          break;
-        }
+      if (has_pending) {
+        run_write(&outp, pending);
       }
+      pending = current[next];
+      has_pending = true;
     }
-
-    if (outp_curr_rec == BUFFER_SIZE) {
-
-      // After flushing it,
-      // we will insert the next record into the array's
-      // first index
-      flush_buffer(output_buffer, outp_fd, outp_curr_rec);
-      outp_curr_rec = 0;
-    }
-
-  } while (true);
-
-  // After breaking, we need to know which of the two files reached
-  // its end, and copy the other one into the output array
-
-  // If we've reached inp file 1's end, we need to flush the
-  // remaining records of the inp file 2
-  bool inp1_flushed = false;
-  if (reached_inp1_end) {
-    int block_num = inp2_curr_block_num;
-    // Iterate over the remaining blocks (if any) and copy them
-    // into the output file
-    if (outp_curr_rec == BUFFER_SIZE) {
-      flush_buffer(output_buffer, outp_fd, outp_curr_rec);
-      outp_curr_rec = 0;
+    if (run_read(&readers[next], &current[next])) {
+      std::push_heap(heap, heap + heap_size, comes_after);
+    } else {
+      heap_size--;
     }
-    do {
-      for (int record_num = buff2_curr_rec; record_num < inp2_size;
-           record_num++) {
-        // If, at any point while copying, we fill out the
-        // output buffer, flush it
-        output_buffer[outp_curr_rec++] = inp2_buffer[record_num];
-        inp1_flushed = false;
-        if (outp_curr_rec == BUFFER_SIZE) {
-          flush_buffer(output_buffer, outp_fd, outp_curr_rec);
-          // Reset the index into which we will write
-          outp_curr_rec = 0;
-          inp1_flushed = true;
-        }
-      }
-
-      if (block_num + 1 == inp2_max_blocks) {
-        break;
-      }
-
-      // If we run out of records in the current buffer
-      // *and* there are remaining blocks in the file,
-      // reset everything and copy them over into main memory
-      inp2_beg = read_block(inp2_fd, ++block_num);
-      fill_buffer(inp2_buffer, inp2_beg, &inp2_size);
-      buff2_curr_rec = 0;
-    } while (true);
   }
-  // If we've reached inp file 2's end, we need to flush the
-  // remaining records of the inp file 1 into the output file
-  bool inp2_flushed = false;
-  if (reached_inp2_end) {
-    if (outp_curr_rec == BUFFER_SIZE) {
-      flush_buffer(output_buffer, outp_fd, outp_curr_rec);
-      outp_curr_rec = 0;
-    }
-    int block_num = inp1_curr_block_num;
-    // Iterate over the remaining blocks (if any) and copy them
-    // into the output file
-    do {
-      for (int record_num = buff1_curr_rec; record_num < inp1_size;
-           record_num++) {
-        // If, at any point while copying, we fill out the
-        // output buffer, flush it
-        output_buffer[outp_curr_rec++] = inp1_buffer[record_num];
-        inp2_flushed = false;
-        if (outp_curr_rec == BUFFER_SIZE) {
-          flush_buffer(output_buffer, outp_fd, outp_curr_rec);
-          // Reset the index into which we will write
-          outp_curr_rec = 0;
-          inp2_flushed = true;
-        }
-      }
+  if (has_pending && (limit == 0 || outp.records < limit)) {
+    run_write(&outp, pending);
+  }
 
-      if (block_num + 1 == inp1_max_blocks) {
-        break;
-      }
+  run_writer_close(&outp);
+  arena_release(arena, mark);
+  return outp.records;
+}
 
-      // If we run out of records in the current buffer
-      // *and* there are remaining blocks in the file,
-      // reset everything and copy them over into main memory
-      inp1_beg = read_block(inp1_fd, ++block_num);
-      fill_buffer(inp1_buffer, inp1_beg, &inp1_size);
-      buff1_curr_rec = 0;
-    } while (true);
-  }
+extern long merge_into_run(SpillFile *spill, const std::vector<int> &inputs,
+                           int outp_run, int fieldNo, long limit,
+                           bool distinct, SortArena *arena) {
+  return merge_runs<Record>(spill, inputs, outp_run, fieldNo, limit, distinct,
+                            arena);
+}
 
-  // If neither of the input buffers caused the output buffer
-  // to be flushed, we flush it now
-  if (!inp1_flushed && !inp2_flushed) {
-    flush_buffer(output_buffer, outp_fd, outp_curr_rec);
-  }
+/*
+ * Same as above, but for runs of key entries
+ */
+extern long merge_keys_into_run(SpillFile *spill,
+                                const std::vector<int> &inputs, int outp_run,
+                                int fieldNo, long limit, bool distinct,
+                                SortArena *arena) {
+  return merge_runs<KeyEntry>(spill, inputs, outp_run, fieldNo, limit,
+                              distinct, arena);
+}
 
-  // Memory cleaning
-  delete[] inp1_buffer;
-  delete[] inp2_buffer;
-  delete[] output_buffer;
+/*
+ * Same as above, but for runs of groups (which are always collapsed)
+ */
+extern long merge_groups_into_run(SpillFile *spill,
+                                  const std::vector<int> &inputs, int outp_run,
+                                  int fieldNo, long limit, SortArena *arena) {
+  return merge_runs<GroupEntry>(spill, inputs, outp_run, fieldNo, limit, true,
+                                arena);
 }
 
 /*
- * Simple function to flush a given buffer (up until a <max> index)
+ * Simple function to flush a given buffer (up until a <max> index).
+ * Since records have variable length, the buffer may span
+ * more than one new block
  */
 extern void flush_buffer(Record *buffer, int file_desc, int max) {
-  int new_block = get_new_block(file_desc);
-  void *outp_beg = read_block(file_desc, new_block);
-  int *filled_spots = (int *)outp_beg + FILLED_OFFSET;
-  for (int index = 0; index < max; index++) {
-    save_record(buffer[index], index, outp_beg);
-    (*filled_spots)++;
+  int index = 0;
+  while (index < max) {
+    int new_block = get_new_block(file_desc);
+    void *outp_beg = read_block(file_desc, new_block);
+    init_page(outp_beg);
+    while (index < max && add_record(buffer[index], outp_beg)) {
+      index++;
+    }
+    write_block(file_desc, new_block);
   }
-  write_block(file_desc, new_block);
 }
 
 extern void fill_buffer(Record *buffer, void *beg, int *size) {
-  int *filled_spots = (int *)beg + FILLED_OFFSET;
-  *size = *filled_spots;
+  *size = get_record_count(beg);
 
-  for (int rec_num = 0; rec_num < *filled_spots; rec_num++) {
+  for (int rec_num = 0; rec_num < *size; rec_num++) {
     buffer[rec_num] = get_record(rec_num, beg);
   }
 }
 
 /*
- * The next two algorithms are the simple merge sort algorithm
- * for an array
+ * Stable insertion sort, for the leaves of the merge sort below
  */
-extern void merge(Record *arr, int l, int m, int r, int fieldNo) {
-  int i, j, k;
-  int n1 = m - l + 1;
-  int n2 = r - m;
+template <typename Entry>
+static void insertion_sort(Entry *arr, int size, int fieldNo) {
+  for (int i = 1; i < size; i++) {
+    if (!checkLessThan(arr[i], arr[i - 1], fieldNo)) {
+      continue;
+    }
+    Entry entry = arr[i];
+    int j = i;
+    do {
+      arr[j] = arr[j - 1];
+      j--;
+    } while (j > 0 && checkLessThan(entry, arr[j - 1], fieldNo));
+    arr[j] = entry;
+  }
+}
 
-  Record L[n1], R[n2];
+/*
+ * Merges the sorted ranges [lo, mid) and [mid, hi) of <from> into
+ * the same positions of <to>
+ */
+template <typename Entry>
+static void merge_ranges(const Entry *from, int lo, int mid, int hi,
+                         int fieldNo, Entry *to) {
+  int i = lo;
+  int j = mid;
+  int k = lo;
+
+  // Ranges that are already in order are just copied
+  if (mid == hi || mid == lo ||
+      !checkLessThan(from[mid], from[mid - 1], fieldNo)) {
+    std::copy(from + lo, from + hi, to + lo);
+    return;
+  }
+  while (i < mid && j < hi) {
+    if (checkLessThan(from[j], from[i], fieldNo)) {
+      to[k++] = from[j++];
+    } else {
+      to[k++] = from[i++];
+    }
+  }
+  std::copy(from + i, from + mid, to + k);
+  std::copy(from + j, from + hi, to + k + (mid - i));
+}
 
-  for (i = 0; i < n1; i++) {
-    L[i] = arr[l + i];
+/*
+ * In-memory merge sort of an array (of records, key entries or groups).
+ * The array is copied once into <scratch> (which holds as many entries
+ * as the array), and from then on the two buffers take turns: the halves
+ * of a range are sorted into one of them, and merged straight into the
+ * other, so every level of the recursion moves every entry once, without
+ * copying the halves out first. Ranges of up to MERGE_SORT_LEAF entries
+ * are insertion sorted in place. On equal keys the left half goes first,
+ * so the sort is stable
+ */
+template <typename Entry>
+static void sort_into(Entry *from, Entry *to, int lo, int hi, int fieldNo) {
+  if (hi - lo <= MERGE_SORT_LEAF) {
+    insertion_sort(to + lo, hi - lo, fieldNo);
+    return;
   }
+  int mid = lo + (hi - lo) / 2;
+  // Both buffers hold the same entries in [lo, hi), so the halves
+  // can be sorted into <from>, using <to> as their scratch space
+  sort_into(to, from, lo, mid, fieldNo);
+  sort_into(to, from, mid, hi, fieldNo);
+  merge_ranges(from, lo, mid, hi, fieldNo, to);
+}
 
-  for (j = 0; j < n2; j++) {
-    R[j] = arr[m + 1 + j];
+template <typename Entry>
+static void merge_sort_entries(Entry *arr, int l, int r, int fieldNo,
+                               Entry *scratch) {
+  int size = r - l + 1;
+  std::copy(arr + l, arr + r + 1, scratch);
+  sort_into(scratch, arr + l, 0, size, fieldNo);
+}
+
+/*
+ * Runs <task>(0) ... <task>(count - 1) on threads of their own, and adds
+ * the comparisons they made to the calling thread's counters
+ */
+template <typename Task> static void run_threads(int count, Task task) {
+  std::vector<long> comparisons((size_t)count);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < count; t++) {
+    threads.emplace_back([&task, &comparisons, t]() {
+      task(t);
+      comparisons[t] = sort_counters.comparisons;
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
   }
+  for (long count : comparisons) {
+    sort_counters.comparisons += count;
+  }
+}
 
-  i = 0;
-  j = 0;
-  k = l;
-  while (i < n1 && j < n2) {
-    if (checkLessThan(L[i], R[j], fieldNo) || checkEqual(L[i], R[j], fieldNo)) {
-      arr[k] = L[i];
-      i++;
-    } else {
-      arr[k] = R[j];
-      j++;
+/*
+ * Parallel merge sort: the array is split into one chunk per thread, the
+ * chunks are merge sorted at the same time, and then merged in pairs,
+ * every pair on a thread of its own, with the array and <scratch> taking
+ * turns as in the merge sort above. Chunks are contiguous and the left
+ * one goes first on equal keys, so the sort is still stable
+ */
+template <typename Entry>
+static void parallel_sort_entries(Entry *arr, int size, int fieldNo,
+                                  Entry *scratch, int threads) {
+  if (threads > size / PARALLEL_SORT_MIN_ENTRIES) {
+    threads = size / PARALLEL_SORT_MIN_ENTRIES;
+  }
+  if (threads <= 1) {
+    if (size > 1) {
+      merge_sort_entries(arr, 0, size - 1, fieldNo, scratch);
     }
-    k++;
+    return;
   }
-
-  while (i < n1) {
-    arr[k] = L[i];
-    i++;
-    k++;
+  std::vector<int> bounds;
+  for (int t = 0; t <= threads; t++) {
+    bounds.push_back((int)((long)size * t / threads));
+  }
+  run_threads(threads, [&](int t) {
+    merge_sort_entries(arr, bounds[t], bounds[t + 1] - 1, fieldNo,
+                       scratch + bounds[t]);
+  });
+
+  Entry *from = arr;
+  Entry *to = scratch;
+  for (int width = 1; width < threads; width *= 2) {
+    int pairs = (threads + 2 * width - 1) / (2 * width);
+    run_threads(pairs, [&](int p) {
+      int lo = bounds[2 * p * width];
+      int mid = bounds[std::min(2 * p * width + width, threads)];
+      int hi = bounds[std::min(2 * p * width + 2 * width, threads)];
+      merge_ranges(from, lo, mid, hi, fieldNo, to);
+    });
+    std::swap(from, to);
   }
+  if (from != arr) {
+    std::copy(from, from + size, arr);
+  }
+}
+
+extern void parallel_merge_sort(Record *arr, int size, int fieldNo,
+                                Record *scratch, int threads) {
+  parallel_sort_entries(arr, size, fieldNo, scratch, threads);
+}
+
+extern void parallel_merge_sort(RecordRef *arr, int size, int fieldNo,
+                                RecordRef *scratch, int threads) {
+  parallel_sort_entries(arr, size, fieldNo, scratch, threads);
+}
 
-  while (j < n2) {
-    arr[k] = R[j];
-    j++;
-    k++;
+/*
+ * The same, for callers without a scratch buffer of their own
+ */
+template <typename Entry>
+static void merge_sort_allocating(Entry *arr, int l, int r, int fieldNo) {
+  if (l < r) {
+    std::vector<Entry> scratch((size_t)(r - l + 1));
+    merge_sort_entries(arr, l, r, fieldNo, scratch.data());
   }
 }
 
+/*
+ * Merges the sorted ranges [l, m] and [m + 1, r] of <arr>
+ */
+template <typename Entry>
+static void merge_allocating(Entry *arr, int l, int m, int r, int fieldNo) {
+  std::vector<Entry> from(arr + l, arr + r + 1);
+  merge_ranges(from.data(), 0, m - l + 1, r - l + 1, fieldNo, arr + l);
+}
+
+extern void merge(Record *arr, int l, int m, int r, int fieldNo) {
+  merge_allocating(arr, l, m, r, fieldNo);
+}
+
 extern void merge_sort(Record *arr, int l, int r, int fieldNo) {
-  if (l < r) {
-    int m = l + (r - l) / 2;
-    merge_sort(arr, l, m, fieldNo);
-    merge_sort(arr, m + 1, r, fieldNo);
+  merge_sort_allocating(arr, l, r, fieldNo);
+}
 
-    merge(arr, l, m, r, fieldNo);
-  }
+extern void merge_sort(Record *arr, int l, int r, int fieldNo,
+                       Record *scratch) {
+  merge_sort_entries(arr, l, r, fieldNo, scratch);
+}
+
+extern void merge(KeyEntry *arr, int l, int m, int r, int fieldNo) {
+  merge_allocating(arr, l, m, r, fieldNo);
+}
+
+extern void merge_sort(KeyEntry *arr, int l, int r, int fieldNo) {
+  merge_sort_allocating(arr, l, r, fieldNo);
+}
+
+extern void merge_sort(KeyEntry *arr, int l, int r, int fieldNo,
+                       KeyEntry *scratch) {
+  merge_sort_entries(arr, l, r, fieldNo, scratch);
+}
+
+extern void merge(GroupEntry *arr, int l, int m, int r, int fieldNo) {
+  merge_allocating(arr, l, m, r, fieldNo);
+}
+
+extern void merge_sort(GroupEntry *arr, int l, int r, int fieldNo) {
+  merge_sort_allocating(arr, l, r, fieldNo);
+}
+
+extern void merge_sort(GroupEntry *arr, int l, int r, int fieldNo,
+                       GroupEntry *scratch) {
+  merge_sort_entries(arr, l, r, fieldNo, scratch);
 }
 
 /*
  * Returns a string with a requested output file name format
  */
 extern char *get_sorted_file_name(const char *file_name, int fieldNo) {
-  char *new_name = new char[50];
-  strcpy(new_name, file_name);
-  strcat(new_name, "_Sorted_");
   std::stringstream ss = std::stringstream();
-  ss << fieldNo;
-  strcat(new_name, ss.str().c_str());
+  ss << file_name << "_Sorted_" << fieldNo;
+  char *new_name = new char[ss.str().size() + 1];
+  strcpy(new_name, ss.str().c_str());
+  return new_name;
+}
+
+/*
+ * Same as above, for the output of a sort with a limit
+ */
+extern char *get_top_file_name(const char *file_name, int fieldNo,
+                               long limit) {
+  std::stringstream ss = std::stringstream();
+  ss << file_name << "_Top_" << limit << "_" << fieldNo;
+  char *new_name = new char[ss.str().size() + 1];
+  strcpy(new_name, ss.str().c_str());
+  return new_name;
+}
+
+/*
+ * <file>_Distinct_<fieldNo> for DISTINCT sorts and
+ * <file>_GroupBy_<fieldNo>.csv for GROUP BY ones
+ */
+extern char *get_aggregate_file_name(const char *file_name, int fieldNo,
+                                     int aggregate) {
+  std::stringstream ss = std::stringstream();
+  if (aggregate == SORT_AGGREGATE_GROUP_BY) {
+    ss << file_name << "_GroupBy_" << fieldNo << ".csv";
+  } else {
+    ss << file_name << "_Distinct_" << fieldNo;
+  }
+  char *new_name = new char[ss.str().size() + 1];
+  strcpy(new_name, ss.str().c_str());
+  return new_name;
+}
+
+/*
+ * The output of a join follows the format:
+ * <left file>_Join_<right file's name, without its directory>_<fieldNo>
+ */
+extern char *get_join_file_name(const char *left, const char *right,
+                                int fieldNo) {
+  const char *right_name = strrchr(right, '/');
+  right_name = right_name != NULL ? right_name + 1 : right;
+  std::stringstream ss = std::stringstream();
+  ss << left << "_Join_" << right_name << "_" << fieldNo;
+  char *new_name = new char[ss.str().size() + 1];
+  strcpy(new_name, ss.str().c_str());
+  return new_name;
+}
+
+/*
+ * The partitions of a range-partitioned sort are kept in <file>_Part_<i>
+ * and listed by the manifest <file>_Sorted_<fieldNo>_Manifest
+ */
+extern char *get_partition_file_name(const char *file_name, int partition) {
+  std::stringstream ss = std::stringstream();
+  ss << file_name << "_Part_" << partition;
+  char *new_name = new char[ss.str().size() + 1];
+  strcpy(new_name, ss.str().c_str());
+  return new_name;
+}
+
+extern char *get_manifest_file_name(const char *file_name, int fieldNo) {
+  std::stringstream ss = std::stringstream();
+  ss << file_name << "_Sorted_" << fieldNo << "_Manifest";
+  char *new_name = new char[ss.str().size() + 1];
+  strcpy(new_name, ss.str().c_str());
   return new_name;
 }
 
@@ -369,57 +474,80 @@ extern char *get_sorted_file_name(const char *file_name, int fieldNo) {
  * After finding a matching record (in Sorted_GetAllEntries())
  * we go through all the records before that one until we find one that
  * is not equal to the value.
- * We also do that for all the records after that one
+ * We also do that for all the records after that one.
+ * <rec_read> is set to the number of extra blocks that had to be read.
+ * The records are only printed if <print> is set, their number is returned
  */
 extern int print_surrounding_records(int curr_block, int file_desc,
                                      int curr_rec_index, void *value,
-                                     int fieldNo, int *rec_read) {
+                                     int fieldNo, int *rec_read,
+                                     bool print) {
 
-  int prev_block = curr_block;
-  int next_block = curr_block;
-  void *starting_beg = read_block(file_desc, curr_block);
-  int curr_rec = curr_rec_index;
+  int max_blocks = BF_GetBlockCounter(file_desc);
+  void *header = Pool_PinBlock(file_desc, 0);
+  int first_block = first_data_block(header);
+  Pool_UnpinBlock(file_desc, 0);
   int records_found = 0;
   int records_read = 0;
+
   /*
-   * Get the found record and print it
-   */
-  Record record = get_record(curr_rec_index, starting_beg);
-  /*
-   * Go back until we find a record that doesn't match
+   * Go back (starting from the found record itself) until we find a record
+   * that doesn't match, or we run out of data blocks
    */
-  void *prev_beg = starting_beg;
-  while (checkEqual(record, value, fieldNo)) {
-    if (curr_rec < 0) {
-      prev_beg = read_block(file_desc, --prev_block);
-      curr_rec = *(int *)prev_beg + FILLED_OFFSET;
+  int block_num = curr_block;
+  int rec_num = curr_rec_index;
+  void *beg = Pool_PinBlock(file_desc, block_num);
+  while (true) {
+    if (rec_num < 0) {
+      Pool_UnpinBlock(file_desc, block_num);
+      if (--block_num < first_block) {
+        break;
+      }
+      beg = Pool_PinBlock(file_desc, block_num);
+      rec_num = get_record_count(beg) - 1;
+      records_read++;
+      continue;
+    }
+    Record record = get_record(rec_num--, beg);
+    if (!checkEqual(record, value, fieldNo)) {
+      Pool_UnpinBlock(file_desc, block_num);
+      break;
     }
-    record = get_record(curr_rec--, prev_beg);
-    records_read++;
-    if (checkEqual(record, value, fieldNo)) {
+    if (print) {
       print_record(record);
-      records_found++;
     }
+    records_found++;
   }
-  curr_rec = curr_rec_index + 1;
-  void *next_beg = starting_beg;
-  record = get_record(curr_rec, prev_beg);
-  int *filled_spots = (int *)next_beg + FILLED_OFFSET;
-
-  // Go forward until we find a record that is not equal to the requested
-  // value
-  while (checkEqual(record, value, fieldNo)) {
-    if (curr_rec == *filled_spots) {
-      next_beg = read_block(file_desc, ++next_block);
-      filled_spots = (int *)next_beg + FILLED_OFFSET;
-    }
 
-    record = get_record(curr_rec++, next_beg);
-    records_read++;
-    if (checkEqual(record, value, fieldNo)) {
+  /*
+   * Go forward until we find a record that is not equal to the requested
+   * value, or we reach the end of the file
+   */
+  block_num = curr_block;
+  rec_num = curr_rec_index + 1;
+  beg = Pool_PinBlock(file_desc, block_num);
+  int filled_spots = get_record_count(beg);
+  while (true) {
+    if (rec_num == filled_spots) {
+      Pool_UnpinBlock(file_desc, block_num);
+      if (++block_num == max_blocks) {
+        break;
+      }
+      beg = Pool_PinBlock(file_desc, block_num);
+      filled_spots = get_record_count(beg);
+      rec_num = 0;
+      records_read++;
+      continue;
+    }
+    Record record = get_record(rec_num++, beg);
+    if (!checkEqual(record, value, fieldNo)) {
+      Pool_UnpinBlock(file_desc, block_num);
+      break;
+    }
+    if (print) {
       print_record(record);
-      records_found++;
     }
+    records_found++;
   }
   *rec_read = records_read;
   return records_found;